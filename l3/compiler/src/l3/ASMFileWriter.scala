@@ -1,7 +1,9 @@
 package l3
 
 import java.io.{ FileWriter, BufferedWriter }
+import java.io.{ FileOutputStream, BufferedOutputStream, DataOutputStream }
 import PCRelativeASMInstructionModule._
+import l3.{ LabeledASMInstructionModule => L }
 
 /**
  * Assembly program writer. Dumps a program to a textual file, in
@@ -20,6 +22,109 @@ object ASMFileWriter extends (String => (Program => Unit)) {
     }
   }
 
+  /**
+   * Symbol map writer. Dumps the code address of the main program and
+   * of every function of a labeled program to a textual file, in which
+   * each line is composed of the address as a 32-bit hexadecimal
+   * value, followed by the name of the function. Used by the VM to
+   * symbolize the call stacks it samples. The program is returned
+   * unchanged.
+   */
+  def symbolMap(fileName: String): (L.LabeledProgram => L.LabeledProgram) = {
+    program =>
+      using(new BufferedWriter(new FileWriter(fileName))) { outStream =>
+        for ((name, addr) <- symbols(program))
+          outStream.write("%08x  %s\n" format (int2Integer(addr), name))
+      }
+      program
+  }
+
+  /**
+   * Liveness map writer. Dumps the registers live after every call of a
+   * program, once resolved, to a textual file, whose first line is the
+   * checksum of the encoded instructions of the program as a 32-bit
+   * hexadecimal value, and in which each other line is composed of the
+   * return address of the call as a 32-bit hexadecimal value, followed
+   * by the numbers of the live registers, as encoded in instructions.
+   * Used by the VM to only scan the live registers of the callers'
+   * frames during garbage collection, if the checksum matches the
+   * program it runs. The program is returned unchanged.
+   */
+  def livenessMap(fileName: String): (Program => Program) = { program =>
+    // FNV-1a hash of the code, as computed by the VM
+    val checksum = (0x811C9DC5 /: (program map encode)) { (h, w) =>
+      (h ^ w) * 16777619
+    }
+    using(new BufferedWriter(new FileWriter(fileName))) { outStream =>
+      outStream.write("%08x\n" format int2Integer(checksum))
+      for ((CALL(_, live), addr) <- program.zipWithIndex) {
+        val regs = (live.toSeq map { r => encReg(r)._1 }).sorted
+        outStream.write("%08x%s\n" format (int2Integer((addr + 1) << 2),
+                                           regs.map(" " + _).mkString))
+      }
+    }
+    program
+  }
+
+  /**
+   * Executable writer. Dumps a labeled program, once resolved, to a
+   * binary file which the VM maps in memory instead of parsing it,
+   * composed of a header, the encoded instructions and the symbols
+   * (see vm/src/executable.h). The program is returned unchanged.
+   */
+  def executable(fileName: String): (L.LabeledProgram => L.LabeledProgram) = {
+    program =>
+      val code = ASMLabelResolver(program) map encode
+      val syms = symbols(program)
+      val symbolWords = syms flatMap { case (name, addr) =>
+        val bytes = name.getBytes("UTF-8")
+        val padded = bytes.padTo((bytes.length + 3) / 4 * 4, 0: Byte)
+        Seq(addr, bytes.length) ++ (padded.grouped(4) map littleEndian)
+      }
+      val body = code ++ symbolWords
+      val header = Seq(
+        ExecutableMagic,
+        ExecutableVersion,
+        ExecutableHeaderWords * 4,                 // code offset
+        code.length,
+        (ExecutableHeaderWords + code.length) * 4, // symbols offset
+        syms.length,
+        0,                                         // checksum, set below
+        0)
+      // FNV-1a hash of the whole file, in which the checksum counts as 0
+      val checksum = (0x811C9DC5 /: (header ++ body)) { (h, w) =>
+        (h ^ w) * 16777619
+      }
+      using(new DataOutputStream(new BufferedOutputStream(
+                                   new FileOutputStream(fileName)))) { out =>
+        for (word <- header.updated(ExecutableChecksumIndex, checksum) ++ body)
+          out.writeInt(Integer.reverseBytes(word))
+      }
+      program
+  }
+
+  private val ExecutableMagic = 0x1A58334C // "L3X" and 0x1A, little-endian
+  private val ExecutableVersion = 2
+  private val ExecutableHeaderWords = 8
+  private val ExecutableChecksumIndex = 6
+
+  private def littleEndian(bytes: Array[Byte]): Int =
+    (bytes.foldRight(0) { (b, w) => (w << 8) | (b & 0xFF) })
+
+  /**
+   * The symbols of a labeled program, sorted by code address: the main
+   * program, and the functions, whose labels are the ones loaded by
+   * LDLO (continuations are only jumped to).
+   */
+  private def symbols(program: L.LabeledProgram): Seq[(String, Int)] = {
+    val addresses = ASMLabelResolver.codeAddresses(program)
+    val functions = (program map (_.instruction) collect {
+                       case L.LDLO(_, L.LabelC(l)) => l
+                     }).distinct
+    (("main", 0) +: (functions map { l => (l.toString, addresses(l)) }))
+      .sortBy(_._2)
+  }
+
   private object Opcode extends Enumeration {
     val ADD, SUB, MUL, DIV, MOD = Value
     val LSL, LSR, AND, OR, XOR = Value
@@ -27,7 +132,9 @@ object ASMFileWriter extends (String => (Program => Unit)) {
     val TCAL, CALL, RET, HALT = Value
     val LDLO, LDHI, MOVE = Value
     val RALO, BALO, BSIZ, BTAG, BGET, BSET = Value
-    val BREA, BWRI = Value
+    val BREA, BWRI, BLKR, BLKW = Value
+    val ADDI, SUBI, LSLI, LSRI, ANDI, ORI = Value
+    val JLTI, JLEI, JGTI, JGEI, JEQI, JNEI = Value
   }
 
   private def encode(instr: Instruction): Int = instr match {
@@ -43,14 +150,28 @@ object ASMFileWriter extends (String => (Program => Unit)) {
     case OR(a, b, c) => packRRR(Opcode.OR, a, b, c)
     case XOR(a, b, c) => packRRR(Opcode.XOR, a, b, c)
 
+    case ADDI(a, b, s) => packRRS(Opcode.ADDI, a, b, s)
+    case SUBI(a, b, s) => packRRS(Opcode.SUBI, a, b, s)
+    case LSLI(a, b, s) => packRRS(Opcode.LSLI, a, b, s)
+    case LSRI(a, b, s) => packRRS(Opcode.LSRI, a, b, s)
+    case ANDI(a, b, s) => packRRS(Opcode.ANDI, a, b, s)
+    case ORI(a, b, s) => packRRS(Opcode.ORI, a, b, s)
+
     case JLT(a, b, d) => packRRD(Opcode.JLT, a, b, d)
     case JLE(a, b, d) => packRRD(Opcode.JLE, a, b, d)
     case JEQ(a, b, d) => packRRD(Opcode.JEQ, a, b, d)
     case JNE(a, b, d) => packRRD(Opcode.JNE, a, b, d)
     case JI(d) => pack(encOp(Opcode.JI), encSInt(d, 26))
 
+    case JLTI(a, s, d) => packRSD(Opcode.JLTI, a, s, d)
+    case JLEI(a, s, d) => packRSD(Opcode.JLEI, a, s, d)
+    case JGTI(a, s, d) => packRSD(Opcode.JGTI, a, s, d)
+    case JGEI(a, s, d) => packRSD(Opcode.JGEI, a, s, d)
+    case JEQI(a, s, d) => packRSD(Opcode.JEQI, a, s, d)
+    case JNEI(a, s, d) => packRSD(Opcode.JNEI, a, s, d)
+
     case TCAL(r) => packR(Opcode.TCAL, r)
-    case CALL(r) => packR(Opcode.CALL, r)
+    case CALL(r, _) => packR(Opcode.CALL, r)
     case RET => pack(encOp(Opcode.RET), pad(26))
     case HALT(r) => packR(Opcode.HALT, r)
 
@@ -70,6 +191,8 @@ object ASMFileWriter extends (String => (Program => Unit)) {
 
     case BREA(a) => packR(Opcode.BREA, a)
     case BWRI(a) => packR(Opcode.BWRI, a)
+    case BLKR(a, b) => packRR(Opcode.BLKR, a, b)
+    case BLKW(a) => packR(Opcode.BLKW, a)
   }
 
   private type BitField = (Int, Int)
@@ -89,6 +212,14 @@ object ASMFileWriter extends (String => (Program => Unit)) {
                       a: ASMRegister, b: ASMRegister, d: Int): Int =
     pack(encOp(opcode), encReg(a), encReg(b), encSInt(d, 10))
 
+  private def packRRS(opcode: Opcode.Value,
+                      a: ASMRegister, b: ASMRegister, s: Int): Int =
+    pack(encOp(opcode), encReg(a), encReg(b), encSInt(s, 10))
+
+  private def packRSD(opcode: Opcode.Value,
+                      a: ASMRegister, s: Int, d: Int): Int =
+    pack(encOp(opcode), encReg(a), encSInt(s, 8), encSInt(d, 10))
+
   private def encOp(opcode: Opcode.Value): BitField =
     encUInt(opcode.id, 6)
 
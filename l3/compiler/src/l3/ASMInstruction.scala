@@ -34,6 +34,13 @@ trait ASMInstructionModule {
   case class XOR(a: ASMRegister, b: ASMRegister, c: ASMRegister)
        extends Instruction
 
+  case class ADDI(a: ASMRegister, b: ASMRegister, s: Int) extends Instruction
+  case class SUBI(a: ASMRegister, b: ASMRegister, s: Int) extends Instruction
+  case class LSLI(a: ASMRegister, b: ASMRegister, s: Int) extends Instruction
+  case class LSRI(a: ASMRegister, b: ASMRegister, s: Int) extends Instruction
+  case class ANDI(a: ASMRegister, b: ASMRegister, s: Int) extends Instruction
+  case class ORI(a: ASMRegister, b: ASMRegister, s: Int) extends Instruction
+
   case class JLT(a: ASMRegister, b: ASMRegister, d: Constant)
       extends Instruction
   case class JLE(a: ASMRegister, b: ASMRegister, d: Constant)
@@ -44,8 +51,19 @@ trait ASMInstructionModule {
       extends Instruction
   case class JI(d: Label) extends Instruction
 
+  case class JLTI(a: ASMRegister, s: Int, d: Constant) extends Instruction
+  case class JLEI(a: ASMRegister, s: Int, d: Constant) extends Instruction
+  case class JGTI(a: ASMRegister, s: Int, d: Constant) extends Instruction
+  case class JGEI(a: ASMRegister, s: Int, d: Constant) extends Instruction
+  case class JEQI(a: ASMRegister, s: Int, d: Constant) extends Instruction
+  case class JNEI(a: ASMRegister, s: Int, d: Constant) extends Instruction
+
   case class TCAL(r: ASMRegister) extends Instruction
-  case class CALL(r: ASMRegister) extends Instruction
+  case class CALL(r: ASMRegister, live: Set[ASMRegister]) extends Instruction {
+    // The registers live after the call are only written to the
+    // liveness map, not to the listing
+    override def toString: String = s"CALL($r)"
+  }
   case object RET extends Instruction
   case class HALT(r: ASMRegister) extends Instruction
 
@@ -65,6 +83,8 @@ trait ASMInstructionModule {
 
   case class BREA(a: ASMRegister) extends Instruction
   case class BWRI(a: ASMRegister) extends Instruction
+  case class BLKR(a: ASMRegister, b: ASMRegister) extends Instruction
+  case class BLKW(a: ASMRegister) extends Instruction
 
   sealed case class LabeledInstruction(labels: Set[Label],
                                        instruction: Instruction) {
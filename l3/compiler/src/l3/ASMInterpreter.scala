@@ -133,6 +133,30 @@ object ASMInterpreter extends (Seq[Instruction] => Unit) {
           R(a) = R(b) ^ R(c)
           PC += 1
 
+        case ADDI(a, b, s) =>
+          R(a) = R(b) + s
+          PC += 1
+
+        case SUBI(a, b, s) =>
+          R(a) = R(b) - s
+          PC += 1
+
+        case LSLI(a, b, s) =>
+          R(a) = R(b) << s
+          PC += 1
+
+        case LSRI(a, b, s) =>
+          R(a) = R(b) >>> s
+          PC += 1
+
+        case ANDI(a, b, s) =>
+          R(a) = R(b) & s
+          PC += 1
+
+        case ORI(a, b, s) =>
+          R(a) = R(b) | s
+          PC += 1
+
         case JLT(a, b, d) =>
           PC += (if (R(a) < R(b)) d else 1)
 
@@ -148,6 +172,24 @@ object ASMInterpreter extends (Seq[Instruction] => Unit) {
         case JI(d) =>
           PC += d
 
+        case JLTI(a, s, d) =>
+          PC += (if (R(a) < s) d else 1)
+
+        case JLEI(a, s, d) =>
+          PC += (if (R(a) <= s) d else 1)
+
+        case JGTI(a, s, d) =>
+          PC += (if (R(a) > s) d else 1)
+
+        case JGEI(a, s, d) =>
+          PC += (if (R(a) >= s) d else 1)
+
+        case JEQI(a, s, d) =>
+          PC += (if ((R(a): L3Int) == s) d else 1)
+
+        case JNEI(a, s, d) =>
+          PC += (if ((R(a): L3Int) != s) d else 1)
+
         case TCAL(a) =>
           val targetPC = R(a) >> 2
           // copy caller state (Ib, Lb, Ob and return address)
@@ -161,7 +203,7 @@ object ASMInterpreter extends (Seq[Instruction] => Unit) {
           R(Ob) = UndefV
           PC = targetPC
 
-        case CALL(a) =>
+        case CALL(a, _) =>
           val targetPC = R(a) >> 2
           // save caller state (Ib, Lb, Ob and return address)
           R(O0) = R(Ib)
@@ -184,6 +226,7 @@ object ASMInterpreter extends (Seq[Instruction] => Unit) {
           R(O0) = retValue
 
         case HALT(_) =>
+          flush()
           done = true
 
         case LDLO(a, s) =>
@@ -230,6 +273,20 @@ object ASMInterpreter extends (Seq[Instruction] => Unit) {
         case BWRI(a) =>
           writeByte(R(a))
           PC += 1
+
+        // Block elements are bytes, represented as tagged integers, and
+        // so is the number of bytes read
+        case BLKR(a, b) =>
+          val contents = R(b).contents
+          val bytes = readBytes(contents.length)
+          for (i <- bytes.indices)
+            contents(i) = ((bytes(i) & 0xFF) << 1) | 1
+          R(a) = (bytes.length << 1) | 1
+          PC += 1
+
+        case BLKW(a) =>
+          writeBytes(R(a).contents map { v => (v: L3Int) >> 1 })
+          PC += 1
       }
     }
   }
@@ -17,6 +17,12 @@ object ASMLabelResolver extends (L.LabeledProgram => R.Program) {
   def apply(labeledProgram: L.LabeledProgram): R.Program =
     resolve(fixedPoint(labeledProgram)(expand))
 
+  /** Returns the code address, in bytes, of the labels of the program */
+  def codeAddresses(labeledProgram: L.LabeledProgram): Map[L.Label, Int] =
+    labelMap(fixedPoint(labeledProgram)(expand).zipWithIndex) mapValues {
+      _ << 2
+    }
+
   private def expand(program: L.LabeledProgram): L.LabeledProgram = {
     val indexedProgram = program.zipWithIndex
     val labelAddr = labelMap(indexedProgram)
@@ -32,6 +38,18 @@ object ASMLabelResolver extends (L.LabeledProgram => R.Program) {
            Seq(L.nl(L.JNE(a, b, L.IntC(2))), L.nl(L.JI(l)))
          case L.JNE(a, b, L.LabelC(l)) if !fitsInNSignedBits(10)(delta(l)) =>
            Seq(L.nl(L.JEQ(a, b, L.IntC(2))), L.nl(L.JI(l)))
+         case L.JLTI(a, s, L.LabelC(l)) if !fitsInNSignedBits(10)(delta(l)) =>
+           Seq(L.nl(L.JGEI(a, s, L.IntC(2))), L.nl(L.JI(l)))
+         case L.JLEI(a, s, L.LabelC(l)) if !fitsInNSignedBits(10)(delta(l)) =>
+           Seq(L.nl(L.JGTI(a, s, L.IntC(2))), L.nl(L.JI(l)))
+         case L.JGTI(a, s, L.LabelC(l)) if !fitsInNSignedBits(10)(delta(l)) =>
+           Seq(L.nl(L.JLEI(a, s, L.IntC(2))), L.nl(L.JI(l)))
+         case L.JGEI(a, s, L.LabelC(l)) if !fitsInNSignedBits(10)(delta(l)) =>
+           Seq(L.nl(L.JLTI(a, s, L.IntC(2))), L.nl(L.JI(l)))
+         case L.JEQI(a, s, L.LabelC(l)) if !fitsInNSignedBits(10)(delta(l)) =>
+           Seq(L.nl(L.JNEI(a, s, L.IntC(2))), L.nl(L.JI(l)))
+         case L.JNEI(a, s, L.LabelC(l)) if !fitsInNSignedBits(10)(delta(l)) =>
+           Seq(L.nl(L.JEQI(a, s, L.IntC(2))), L.nl(L.JI(l)))
          // TODO: LDLO
          case _ => Seq(labeledInstr)
        }
@@ -56,6 +74,12 @@ object ASMLabelResolver extends (L.LabeledProgram => R.Program) {
         case L.AND(a, b, c)           => R.AND(a, b, c)
         case L.OR(a, b, c)            => R.OR(a, b, c)
         case L.XOR(a, b, c)           => R.XOR(a, b, c)
+        case L.ADDI(a, b, s)          => R.ADDI(a, b, s)
+        case L.SUBI(a, b, s)          => R.SUBI(a, b, s)
+        case L.LSLI(a, b, s)          => R.LSLI(a, b, s)
+        case L.LSRI(a, b, s)          => R.LSRI(a, b, s)
+        case L.ANDI(a, b, s)          => R.ANDI(a, b, s)
+        case L.ORI(a, b, s)           => R.ORI(a, b, s)
         case L.JLT(a, b, L.IntC(d))   => R.JLT(a, b, d)
         case L.JLT(a, b, L.LabelC(l)) => R.JLT(a, b, delta(l))
         case L.JLE(a, b, L.IntC(d))   => R.JLE(a, b, d)
@@ -65,8 +89,20 @@ object ASMLabelResolver extends (L.LabeledProgram => R.Program) {
         case L.JNE(a, b, L.IntC(d))   => R.JNE(a, b, d)
         case L.JNE(a, b, L.LabelC(l)) => R.JNE(a, b, delta(l))
         case L.JI(l)                  => R.JI(delta(l))
+        case L.JLTI(a, s, L.IntC(d))   => R.JLTI(a, s, d)
+        case L.JLTI(a, s, L.LabelC(l)) => R.JLTI(a, s, delta(l))
+        case L.JLEI(a, s, L.IntC(d))   => R.JLEI(a, s, d)
+        case L.JLEI(a, s, L.LabelC(l)) => R.JLEI(a, s, delta(l))
+        case L.JGTI(a, s, L.IntC(d))   => R.JGTI(a, s, d)
+        case L.JGTI(a, s, L.LabelC(l)) => R.JGTI(a, s, delta(l))
+        case L.JGEI(a, s, L.IntC(d))   => R.JGEI(a, s, d)
+        case L.JGEI(a, s, L.LabelC(l)) => R.JGEI(a, s, delta(l))
+        case L.JEQI(a, s, L.IntC(d))   => R.JEQI(a, s, d)
+        case L.JEQI(a, s, L.LabelC(l)) => R.JEQI(a, s, delta(l))
+        case L.JNEI(a, s, L.IntC(d))   => R.JNEI(a, s, d)
+        case L.JNEI(a, s, L.LabelC(l)) => R.JNEI(a, s, delta(l))
         case L.TCAL(a)                => R.TCAL(a)
-        case L.CALL(a)                => R.CALL(a)
+        case L.CALL(a, live)          => R.CALL(a, live)
         case L.RET                    => R.RET
         case L.HALT(a)                => R.HALT(a)
         case L.LDLO(a, L.IntC(s))     => R.LDLO(a, s)
@@ -81,6 +117,8 @@ object ASMLabelResolver extends (L.LabeledProgram => R.Program) {
         case L.BSET(a, b, c)          => R.BSET(a, b, c)
         case L.BREA(a)                => R.BREA(a)
         case L.BWRI(a)                => R.BWRI(a)
+        case L.BLKR(a, b)             => R.BLKR(a, b)
+        case L.BLKW(a)                => R.BLKW(a)
       }
     }
   }
@@ -16,8 +16,11 @@ object CL3Interpreter extends (Tree => Unit) {
       eval(program)(Map.empty)
     } catch {
       case e: EvalError =>
+        flush()
         for (msgs <- e.messages; msg <- msgs.reverseIterator)
           println(msg)
+    } finally {
+      flush()
     }
 
   // Values
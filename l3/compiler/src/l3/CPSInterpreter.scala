@@ -70,7 +70,7 @@ sealed abstract class CPSInterpreter[M <: CPSTreeModule](
         eval(cntV.body, cntV.env)
 
       case Halt(_) =>
-        ()
+        flush()
     }
   }
 
@@ -215,6 +215,12 @@ class CPSInterpreterLow(log: SymbolicCPSTreeModuleLow.Tree => Unit)
 
       case (CPSByteRead, Seq()) => IntV(readByte())
       case (CPSByteWrite, Seq(c)) => writeByte(c); IntV(0)
+      case (CPSBlockRead, Seq(BlockV(_, _, c))) =>
+        val bytes = readBytes(c.length)
+        for (i <- bytes.indices) c(i) = IntV(((bytes(i) & 0xFF) << 1) | 1)
+        IntV((bytes.length << 1) | 1)
+      case (CPSBlockWrite, Seq(BlockV(_, _, c))) =>
+        writeBytes(c map { v => (v: L3Int) >> 1 }); IntV(0)
 
       case (CPSBlockAlloc(t), Seq(IntV(s))) =>
         allocBlock(t, Array.fill(s)(IntV(0)))
@@ -24,6 +24,8 @@ case object CPSXOr extends CPSValuePrimitive("xor")
 
 case object CPSByteRead extends CPSValuePrimitive("byte-read")
 case object CPSByteWrite extends CPSValuePrimitive("byte-write")
+case object CPSBlockRead extends CPSValuePrimitive("block-read!")
+case object CPSBlockWrite extends CPSValuePrimitive("block-write")
 
 case class CPSBlockAlloc(tag: L3BlockTag)
     extends CPSValuePrimitive(s"block-alloc-${tag}")
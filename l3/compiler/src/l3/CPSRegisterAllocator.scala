@@ -1,5 +1,7 @@
 package l3
 
+import BitTwiddling.{ fitsInNSignedBits, fitsInNUnsignedBits }
+import collection.mutable.{ Map => MutableMap }
 import l3.{ SymbolicCPSTreeModuleLow => S }
 import l3.{ RegisterCPSTreeModule => R }
 
@@ -15,21 +17,35 @@ import l3.{ RegisterCPSTreeModule => R }
   *   I4/O0   contains return value (copied by RET instruction)
   *   Ob, Lb  are initially zero
   *
+  * Literals whose uses can all be immediate operands of instructions
+  * get no register, and are replaced by immediate names in the tree.
+  *
   * Parallel-move algorithm taken from "Tilting at windmills with Coq"
   * by Rideau et al.
   *
+  * The registers live after every non-tail call, which are the only
+  * ones of the caller that the garbage collector has to scan while the
+  * callee runs, are returned along with the tree, indexed by the name
+  * of the return continuation of the call.
+  *
   * @author Michel Schinz <Michel.Schinz@epfl.ch>
   */
 
-object CPSRegisterAllocator extends (S.Tree => R.Tree) {
-  def apply(tree: S.Tree): R.Tree =
-    transform(tree, initialState(tree))
+object CPSRegisterAllocator
+    extends (S.Tree => (R.Tree, Map[Symbol, Set[ASMRegister]])) {
+  def apply(tree: S.Tree): (R.Tree, Map[Symbol, Set[ASMRegister]]) = {
+    val liveAfterCalls = MutableMap[S.Name, Set[ASMRegister]]()
+    val rTree = transform(tree, initialState(tree, liveAfterCalls))
+    (rTree, liveAfterCalls.toMap)
+  }
 
   private val I3 = ASMRegisterFile.in(3)
   private val I4 = ASMRegisterFile.in(4)
   private val O0 = ASMRegisterFile.out(0)
 
   private def transform(tree: S.Tree, s: State): R.Tree = tree match {
+    case S.LetL(name, value, body) if isImmediate(name, value, body, s) =>
+      transform(body, s.withImmediate(name, value))
     case S.LetL(name, value, body) =>
       s.withFreshRegFor(name, tree) { (r, s) =>
         R.LetL(r, value, transform(body, s))
@@ -37,7 +53,7 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
 
     case S.LetP(name, prim, args, body) =>
       s.withFreshRegFor(name, tree) { (r, s) =>
-        s.withRegsContaining(args, tree) { (rArgs, s) =>
+        s.withOperandsContaining(args, tree) { (rArgs, s) =>
           R.LetP(r, prim, rArgs, transform(body, s))
         }
       }
@@ -58,7 +74,7 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
       }
 
     case S.LetF(funs, body) =>
-      R.LetF(funs map transform, transform(body, s))
+      R.LetF(funs map (transform(_, s.liveAfterCalls)), transform(body, s))
 
     case S.AppC(cont, args) =>
       s.withRegsContaining(args, tree) { (rArgs, s) =>
@@ -68,6 +84,8 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
       }
 
     case S.AppF(fun, retC, args) =>
+      if (s.cLiveVars contains retC)
+        s.liveAfterCalls(retC) = s.registersOf(s.cLiveVars(retC))
       s.withRegContaining(fun, tree) { (rFun, s) =>
         s.withRegsContaining(args, tree) { (rArgs, s) =>
           val rOutF = ccOutRegs(args.length)
@@ -77,7 +95,7 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
       }
 
     case S.If(cond, args, thenC, elseC) =>
-      R.If(cond, args map s.regs, R.Label(thenC), R.Label(elseC))
+      R.If(cond, args map s.operand, R.Label(thenC), R.Label(elseC))
 
     case S.Halt(arg) =>
       R.Halt(s.regs(arg))
@@ -93,18 +111,76 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
       R.CntDef(R.Label(cnt.name), s.cArgs(cnt.name), transform(cnt.body, s))
   }
 
-  private def transform(fun: S.FunDef): R.FunDef = {
+  private def transform(fun: S.FunDef,
+                        liveAfterCalls: MutableMap[S.Name, Set[ASMRegister]])
+      : R.FunDef = {
     val rArgs = ccInRegs(fun.args.length)
-    val s = (initialState(fun.body)
+    val s = (initialState(fun.body, liveAfterCalls)
                .withAssignedReg(fun.retC, R.Reg(I3))
                .withAssignedRegs(fun.args, rArgs)
                .copy(cArgs = Map(fun.retC -> Seq(R.Reg(I4)))))
     R.FunDef(R.Label(fun.name), R.Reg(I3), rArgs, transform(fun.body, s))
   }
 
+  /**
+    * Returns true iff all uses of the given name, bound to the given
+    * literal, can be immediate operands: the second operand of an
+    * arithmetic or logical primitive (or either operand if it is
+    * commutative), or either operand of a test, if the literal fits in
+    * the immediate field of the instruction and the other operand is
+    * not an immediate itself.
+    */
+  private def isImmediate(name: S.Name,
+                          value: L3Int,
+                          tree: S.Tree,
+                          s: State): Boolean = {
+    def isOperand(args: Seq[S.Name], commutative: Boolean): Boolean =
+      args match {
+        case Seq(b, `name`) => b != name && !(s.imms contains b)
+        case Seq(`name`, c) => c != name && commutative && !(s.imms contains c)
+        case _ => false
+      }
+
+    def isPrimOperand(prim: CPSValuePrimitive, args: Seq[S.Name]) =
+      prim match {
+        case CPSAdd | CPSAnd | CPSOr =>
+          fitsInNSignedBits(10)(value) && isOperand(args, true)
+        case CPSSub =>
+          fitsInNSignedBits(10)(value) && isOperand(args, false)
+        case CPSShiftLeft | CPSShiftRight =>
+          fitsInNUnsignedBits(5)(value) && isOperand(args, false)
+        case _ =>
+          false
+      }
+
+    def usesOK(tree: S.Tree): Boolean = tree match {
+      case S.LetL(_, _, body) =>
+        usesOK(body)
+      case S.LetP(_, prim, args, body) =>
+        (!(args contains name) || isPrimOperand(prim, args)) && usesOK(body)
+      case S.LetC(cnts, body) =>
+        (cnts forall { c => usesOK(c.body) }) && usesOK(body)
+      case S.LetF(funs, body) =>
+        (funs forall { f => usesOK(f.body) }) && usesOK(body)
+      case S.AppC(cont, args) =>
+        !((cont +: args) contains name)
+      case S.AppF(fun, retC, args) =>
+        !((fun +: retC +: args) contains name)
+      case S.If(_, args, _, _) =>
+        !(args contains name) ||
+          (fitsInNSignedBits(8)(value) && isOperand(args, true))
+      case S.Halt(arg) =>
+        arg != name
+    }
+
+    usesOK(tree)
+  }
+
   private case class State(retConts: Set[S.Name],
+                           liveAfterCalls: MutableMap[S.Name, Set[ASMRegister]],
                            cLiveVars: Map[S.Name, Set[S.Name]] = Map.empty,
                            regs: Map[S.Name, R.Reg] = Map.empty,
+                           imms: Map[S.Name, R.Imm] = Map.empty,
                            cArgs: Map[S.Name, Seq[R.Reg]] = Map.empty) {
     def withAssignedReg(name: S.Name, reg: R.Reg) =
       copy(regs = regs + (name -> reg))
@@ -113,6 +189,9 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
       (this /: (names zip regs)) { case (s, (n, r)) => s.withAssignedReg(n, r) }
     }
 
+    def withImmediate(name: S.Name, value: L3Int) =
+      copy(imms = imms + (name -> R.Imm(value)))
+
     def withCntArgs(name: S.Name, args: Seq[R.Reg]) =
       copy(cArgs = cArgs + (name -> args))
 
@@ -157,6 +236,20 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
             withRegsContaining(ns, cont) { (rNs, s) => body(rN +: rNs, s) } }
       }
 
+    def withOperandsContaining(names: Seq[S.Name], cont: S.Tree)
+                              (body: (Seq[R.Name], State) => R.Tree): R.Tree =
+      names match {
+        case Seq() =>
+          body(Seq(), this)
+        case Seq(n, ns @ _*) if imms contains n =>
+          withOperandsContaining(ns, cont) { (rNs, s) =>
+            body(imms(n) +: rNs, s) }
+        case Seq(n, ns @ _*) =>
+          withRegContaining(n, cont) { (rN, s) =>
+            withOperandsContaining(ns, cont) { (rNs, s) =>
+              body(rN +: rNs, s) } }
+      }
+
     def withParallelCopy(toS: Seq[R.Reg], fromS: Seq[R.Reg], cont: S.Tree)
                         (body: R.Tree): R.Tree = {
       type Move = (R.Reg, R.Reg)
@@ -202,9 +295,15 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
       }
     }
 
+    def registersOf(names: Set[S.Name]): Set[ASMRegister] =
+      names flatMap { n => regs get n map (_.reg) }
+
     def rOrL(name: S.Name): R.Name =
       regs.getOrElse(name, R.Label(name))
 
+    def operand(name: S.Name): R.Name =
+      imms.getOrElse(name, regs(name))
+
     def liveVariables(tree: S.Tree): Set[S.Name] = tree match {
       case S.LetL(_, _, body) =>
         liveVariables(body)
@@ -228,7 +327,9 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
     }
   }
 
-  private def initialState(tree: S.Tree): State = {
+  private def initialState(tree: S.Tree,
+                           liveAfterCalls: MutableMap[S.Name, Set[ASMRegister]])
+      : State = {
     def retContsT(tree: S.Tree): Set[S.Name] = tree match {
       case S.LetL(_, _, body) => retContsT(body)
       case S.LetP(_, _, _, body) => retContsT(body)
@@ -241,7 +342,7 @@ object CPSRegisterAllocator extends (S.Tree => R.Tree) {
     def retContsC(cnt: S.CntDef): Set[S.Name] =
       retContsT(cnt.body)
 
-    State(retConts = retContsT(tree))
+    State(retConts = retContsT(tree), liveAfterCalls = liveAfterCalls)
   }
 
   private def ccInRegs(n: Int): Seq[R.Reg] = {
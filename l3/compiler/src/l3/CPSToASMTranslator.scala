@@ -7,15 +7,22 @@ import RegisterCPSTreeModule._
 import LabeledASMInstructionModule._
 
 /**
- * An ASM code generator for CPS/L₃.
+ * An ASM code generator for CPS/L₃. Calls are annotated with the
+ * registers live after them, as computed by the register allocator.
  *
  * @author Michel Schinz <Michel.Schinz@epfl.ch>
  */
 
-object CPSToASMTranslator extends (Tree => LabeledProgram) {
+object CPSToASMTranslator
+    extends (((Tree, Map[Symbol, Set[ASMRegister]])) => LabeledProgram) {
   private val I3 = ASMRegisterFile.in(3)
+  // Registers considered live after calls whose continuation has no
+  // liveness information (all those of the caller's frame)
+  private val allFrameRegs: Set[ASMRegister] =
+    (ASMRegisterFile.local ++ ASMRegisterFile.in).toSet
 
-  def apply(tree: Tree): LabeledProgram = {
+  def apply(input: (Tree, Map[Symbol, Set[ASMRegister]])): LabeledProgram = {
+    val (tree, liveAfterCalls) = input
     val conts = MutableMap[Symbol, Tree]()
 
     def linearize(tree: Tree, acc: LabeledProgram = Seq()): LabeledProgram = {
@@ -29,7 +36,7 @@ object CPSToASMTranslator extends (Tree => LabeledProgram) {
 
           def regIn(n: Name): Set[ASMRegister] = n match {
             case Reg(r) => Set(r)
-            case Label(_) => Set.empty
+            case Label(_) | Imm(_) => Set.empty
           }
 
           def regsIn(ns: Seq[Name]): Set[ASMRegister] =
@@ -82,6 +89,25 @@ object CPSToASMTranslator extends (Tree => LabeledProgram) {
           case (CPSNe, true) | (CPSEq, false) => nl(JNE(a, b, LabelC(c)))
         }
 
+      // Jump to c iff `a p s` (or `s p a` if swapped) is w
+      def condJumpI(p: CPSTestPrimitive,
+                    a: ASMRegister,
+                    s: Int,
+                    swapped: Boolean,
+                    w: Boolean,
+                    c: Symbol) = {
+        type J = (ASMRegister, Int, Constant) => Instruction
+        val (jump, negJump): (J, J) = (p, swapped) match {
+          case (CPSLt, false) => (JLTI, JGEI)
+          case (CPSLt, true)  => (JGTI, JLEI)
+          case (CPSLe, false) => (JLEI, JGTI)
+          case (CPSLe, true)  => (JGEI, JLTI)
+          case (CPSEq, _)     => (JEQI, JNEI)
+          case (CPSNe, _)     => (JNEI, JEQI)
+        }
+        nl((if (w) jump else negJump)(a, s, LabelC(c)))
+      }
+
       tree match {
         case LetL(Reg(a), v, body) if fitsInNSignedBits(18)(v) =>
           linearize(body, acc :+ nl(LDLO(a, IntC(v))))
@@ -90,6 +116,25 @@ object CPSToASMTranslator extends (Tree => LabeledProgram) {
           val msb16: Int = v >>> 16
           linearize(body, acc :+ nl(LDLO(a, IntC(lsb16))) :+ nl(LDHI(a, msb16)))
 
+        case LetP(Reg(a), CPSAdd, Seq(Reg(b), Imm(s)), body) =>
+          linearize(body, acc :+ nl(ADDI(a, b, s)))
+        case LetP(Reg(a), CPSAdd, Seq(Imm(s), Reg(b)), body) =>
+          linearize(body, acc :+ nl(ADDI(a, b, s)))
+        case LetP(Reg(a), CPSSub, Seq(Reg(b), Imm(s)), body) =>
+          linearize(body, acc :+ nl(SUBI(a, b, s)))
+        case LetP(Reg(a), CPSShiftLeft, Seq(Reg(b), Imm(s)), body) =>
+          linearize(body, acc :+ nl(LSLI(a, b, s)))
+        case LetP(Reg(a), CPSShiftRight, Seq(Reg(b), Imm(s)), body) =>
+          linearize(body, acc :+ nl(LSRI(a, b, s)))
+        case LetP(Reg(a), CPSAnd, Seq(Reg(b), Imm(s)), body) =>
+          linearize(body, acc :+ nl(ANDI(a, b, s)))
+        case LetP(Reg(a), CPSAnd, Seq(Imm(s), Reg(b)), body) =>
+          linearize(body, acc :+ nl(ANDI(a, b, s)))
+        case LetP(Reg(a), CPSOr, Seq(Reg(b), Imm(s)), body) =>
+          linearize(body, acc :+ nl(ORI(a, b, s)))
+        case LetP(Reg(a), CPSOr, Seq(Imm(s), Reg(b)), body) =>
+          linearize(body, acc :+ nl(ORI(a, b, s)))
+
         case LetP(Reg(a), CPSAdd, Seq(Reg(b), Reg(c)), body) =>
           linearize(body, acc :+ nl(ADD(a, b, c)))
         case LetP(Reg(a), CPSSub, Seq(Reg(b), Reg(c)), body) =>
@@ -116,6 +161,10 @@ object CPSToASMTranslator extends (Tree => LabeledProgram) {
           linearize(body, acc :+ nl(BREA(a)))
         case LetP(_, CPSByteWrite, Seq(Reg(a)), body) =>
           linearize(body, acc :+ nl(BWRI(a)))
+        case LetP(Reg(a), CPSBlockRead, Seq(Reg(b)), body) =>
+          linearize(body, acc :+ nl(BLKR(a, b)))
+        case LetP(_, CPSBlockWrite, Seq(Reg(a)), body) =>
+          linearize(body, acc :+ nl(BLKW(a)))
 
         case LetP(Reg(a), CPSBlockAlloc(t), Seq(Reg(b)), body) =>
           linearize(body, acc :+ nl(BALO(a, b, t)))
@@ -152,24 +201,29 @@ object CPSToASMTranslator extends (Tree => LabeledProgram) {
           acc :+ nl(RET)
 
         case AppF(Reg(fun), Label(rc), _) =>
-          (acc :+ nl(CALL(fun))) ++ contOrJump(rc)
+          (acc :+ nl(CALL(fun, liveAfterCalls.getOrElse(rc, allFrameRegs)))) ++ contOrJump(rc)
         case AppF(Reg(fun), Reg(I3), _) =>
           acc :+ nl(TCAL(fun))
 
-        case If(p, Seq(Reg(a), Reg(b)), Label(thenC), Label(elseC)) =>
+        case If(p, args, Label(thenC), Label(elseC)) =>
+          def jump(w: Boolean, c: Symbol) = args match {
+            case Seq(Reg(a), Reg(b)) => condJump(p, a, b, w, c)
+            case Seq(Reg(a), Imm(s)) => condJumpI(p, a, s, false, w, c)
+            case Seq(Imm(s), Reg(b)) => condJumpI(p, b, s, true, w, c)
+          }
           (conts remove thenC, conts remove elseC) match {
             case (Some(thenT), Some(elseT)) =>
               val thenP = labeled(thenC, linearize(thenT))
               val elseP = labeled(elseC, linearize(elseT))
-              (acc :+ condJump(p, a, b, false, elseC)) ++ thenP ++ elseP
+              (acc :+ jump(false, elseC)) ++ thenP ++ elseP
             case (Some(thenT), None) =>
               val thenP = labeled(thenC, linearize(thenT))
-              (acc :+ condJump(p, a, b, false, elseC)) ++ thenP
+              (acc :+ jump(false, elseC)) ++ thenP
             case (None, Some(elseT)) =>
               val elseP = labeled(elseC, linearize(elseT))
-              (acc :+ condJump(p, a, b, true, thenC)) ++ elseP
+              (acc :+ jump(true, thenC)) ++ elseP
             case (None, None) =>
-              acc :+ condJump(p, a, b, true, thenC) :+ nl(JI(elseC))
+              acc :+ jump(true, thenC) :+ nl(JI(elseC))
           }
 
         case Halt(Reg(arg)) =>
@@ -89,18 +89,21 @@ object SymbolicCPSTreeModuleLow extends CPSTreeModule {
 
 /**
  * Module for register-allocated CPS trees: names either represent ASM
- * registers or ASM labels. (Since register names are often reused,
- * names are no longer globally unique as previously).
+ * registers, ASM labels or small constants used as immediate operands
+ * of instructions. (Since register names are often reused, names are
+ * no longer globally unique as previously).
  */
 object RegisterCPSTreeModule extends CPSTreeModule {
   sealed abstract class Name {
     override def toString: String = this match {
       case Reg(r) => r.toString
       case Label(l) => l.toString
+      case Imm(v) => s"#${v}"
     }
   }
   case class Reg(reg: ASMRegister) extends Name
   case class Label(label: Symbol) extends Name
+  case class Imm(value: L3Int) extends Name
 
   type ValuePrimitive = CPSValuePrimitive
   type TestPrimitive = CPSTestPrimitive
@@ -1,5 +1,7 @@
 package l3
 
+import java.io.BufferedOutputStream
+
 /**
  * Helper module for IO functions in L₃ and intermediate languages.
  *
@@ -7,11 +9,33 @@ package l3
  */
 
 object IO {
-  def readByte(): L3Int =
+  // Output is buffered, and flushed when the buffer is full, before
+  // reading input, and on flush (which interpreters call on halt).
+  private val out = new BufferedOutputStream(System.out, 1 << 16)
+
+  def readByte(): L3Int = {
+    flush()
     System.in.read()
+  }
 
-  def writeByte(c: L3Int): Unit = {
-    System.out.write(c)
-    System.out.flush()
+  def writeByte(c: L3Int): Unit =
+    out.write(c)
+
+  def readBytes(n: Int): Array[Byte] = {
+    flush()
+    val bytes = new Array[Byte](n)
+    var count = 0
+    var read = 0
+    while (count < n && read >= 0) {
+      read = System.in.read(bytes, count, n - count)
+      if (read > 0) count += read
+    }
+    bytes take count
   }
+
+  def writeBytes(bytes: Seq[L3Int]): Unit =
+    bytes foreach out.write
+
+  def flush(): Unit =
+    out.flush()
 }
@@ -38,7 +38,10 @@ object Main {
             // andThen CPSInterpreterLow
             andThen CPSRegisterAllocator
             andThen CPSToASMTranslator
+            andThen ASMFileWriter.symbolMap("out.asm.sym")
+            andThen ASMFileWriter.executable("out.l3x")
             andThen ASMLabelResolver
+            andThen ASMFileWriter.livenessMap("out.live")
             // andThen ASMInterpreter
             andThen ASMFileWriter("out.asm")
         )
@@ -72,6 +75,7 @@ object Main {
     }
 
   private[this] def fatalError(msg: String): Nothing = {
+    IO.flush()
     println(s"Error: ${msg}")
     sys.exit(1)
   }
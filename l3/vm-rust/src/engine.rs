@@ -1,6 +1,8 @@
 use std::io;
+use std::io::{Read, Write};
 
 use memory_nofree::Memory;
+use program::Program;
 use {L3Value, LOG2_VALUE_BYTES};
 
 const TAG_REGISTER_FRAME : L3Value = 201;
@@ -35,12 +37,29 @@ const BGET : L3Value = 26;
 const BSET : L3Value = 27;
 const BREA : L3Value = 28;
 const BWRI : L3Value = 29;
+const BLKR : L3Value = 30;
+const BLKW : L3Value = 31;
+const ADDI : L3Value = 32;
+const SUBI : L3Value = 33;
+const LSLI : L3Value = 34;
+const LSRI : L3Value = 35;
+const ANDI : L3Value = 36;
+const ORI  : L3Value = 37;
+const JLTI : L3Value = 38;
+const JLEI : L3Value = 39;
+const JGTI : L3Value = 40;
+const JGEI : L3Value = 41;
+const JEQI : L3Value = 42;
+const JNEI : L3Value = 43;
 
 pub struct Engine {
     ib: usize,
     lb: usize,
     ob: usize,
     mem: Memory,
+    program: Program,
+    input: io::StdinLock<'static>,
+    output: io::BufWriter<io::Stdout>,
 }
 
 fn extract_u(instr: L3Value, start: u32, len: u32) -> L3Value {
@@ -72,8 +91,41 @@ fn offset_pc(pc: usize, offset: L3Value) -> usize {
 }
 
 impl Engine {
-    pub fn new(mem: Memory) -> Engine {
-        Engine { ib: 0, lb: 0, ob: 0, mem: mem }
+    pub fn new(mem: Memory, program: Program) -> Engine {
+        Engine { ib: 0, lb: 0, ob: 0, mem: mem, program: program,
+                 input: io::stdin().lock(),
+                 output: io::BufWriter::with_capacity(1 << 16, io::stdout()) }
+    }
+
+    fn read_byte(&mut self) -> L3Value {
+        self.output.flush().expect("flush error");
+
+        let mut byte = [0u8; 1];
+        match self.input.read(&mut byte) {
+            Ok(1) => byte[0] as L3Value,
+            _     => -1
+        }
+    }
+
+    // Fill bytes from the input, return the number of bytes read, which
+    // is less than its length only at the end of the input
+    fn read_bytes(&mut self, bytes: &mut [u8]) -> usize {
+        self.output.flush().expect("flush error");
+
+        let mut count = 0;
+        while count < bytes.len() {
+            match self.input.read(&mut bytes[count..]) {
+                Ok(0) => break,
+                Ok(n) => count += n,
+                Err(ref e) if e.kind() == io::ErrorKind::Interrupted => (),
+                Err(_) => break
+            }
+        }
+        count
+    }
+
+    fn write_byte(&mut self, byte: L3Value) {
+        self.output.write_all(&[byte as u8; 1]).expect("write error");
     }
 
     fn reg_ix(&self, r: L3Value) -> usize {
@@ -125,6 +177,13 @@ impl Engine {
         self.mem[ra_ix] = op(l, r)
     }
 
+    fn arith_imm<F>(&mut self, instr: L3Value, op: F)
+        where F: Fn(L3Value, L3Value) -> L3Value {
+        let ra_ix = self.ra_ix(instr);
+        let l = self.rb(instr);
+        self.mem[ra_ix] = op(l, extract_s(instr, 0, 10))
+    }
+
     fn cond_pc<F>(&mut self, pc: usize, instr: L3Value, op: F) -> usize
         where F: Fn(L3Value, L3Value) -> bool {
         let l = self.ra(instr);
@@ -132,11 +191,18 @@ impl Engine {
         offset_pc(pc, if op(l, r) { extract_s(instr, 0, 10) } else { 1 })
     }
 
+    fn cond_pc_imm<F>(&mut self, pc: usize, instr: L3Value, op: F) -> usize
+        where F: Fn(L3Value, L3Value) -> bool {
+        let l = self.ra(instr);
+        let r = extract_s(instr, 10, 8);
+        offset_pc(pc, if op(l, r) { extract_s(instr, 0, 10) } else { 1 })
+    }
+
     pub fn run(&mut self) -> L3Value {
         let mut pc: usize = 0;
 
         loop {
-            let inst = self.mem[pc];
+            let inst = self.program[pc];
             let opcode = opcode(inst);
 
             match opcode {
@@ -180,6 +246,31 @@ impl Engine {
                     self.arith(inst, |x, y| x ^ y);
                     pc += 1;
                 }
+                ADDI => {
+                    self.arith_imm(inst, |x, y| x.wrapping_add(y));
+                    pc += 1;
+                }
+                SUBI => {
+                    self.arith_imm(inst, |x, y| x.wrapping_sub(y));
+                    pc += 1;
+                }
+                LSLI => {
+                    self.arith_imm(inst, |x, y| x.wrapping_shl(y as u32));
+                    pc += 1;
+                }
+                LSRI => {
+                    self.arith_imm(inst, |x, y|
+                                   (x as u32).wrapping_shr(y as u32) as L3Value);
+                    pc += 1;
+                }
+                ANDI => {
+                    self.arith_imm(inst, |x, y| x & y);
+                    pc += 1;
+                }
+                ORI => {
+                    self.arith_imm(inst, |x, y| x | y);
+                    pc += 1;
+                }
                 JLT => {
                     pc = self.cond_pc(pc, inst, |x, y| x < y)
                 }
@@ -195,6 +286,24 @@ impl Engine {
                 JI => {
                     pc = offset_pc(pc, extract_s(inst, 0, 26))
                 }
+                JLTI => {
+                    pc = self.cond_pc_imm(pc, inst, |x, y| x < y)
+                }
+                JLEI => {
+                    pc = self.cond_pc_imm(pc, inst, |x, y| x <= y)
+                }
+                JGTI => {
+                    pc = self.cond_pc_imm(pc, inst, |x, y| x > y)
+                }
+                JGEI => {
+                    pc = self.cond_pc_imm(pc, inst, |x, y| x >= y)
+                }
+                JEQI => {
+                    pc = self.cond_pc_imm(pc, inst, |x, y| x == y)
+                }
+                JNEI => {
+                    pc = self.cond_pc_imm(pc, inst, |x, y| x != y)
+                }
                 TCAL => {
                     let target_pc = address_to_index(self.ra(inst));
                     let ctx0 = self.mem[self.ib + 0];
@@ -240,6 +349,7 @@ impl Engine {
                     pc = ret_pc;
                 }
                 HALT => {
+                    self.output.flush().expect("flush error");
                     return self.ra(inst);
                 }
                 LDLO => {
@@ -313,23 +423,36 @@ impl Engine {
                     pc += 1;
                 }
                 BREA => {
-                    use std::io::{Read,Write};
-
-                    io::stdout().flush().expect("flush error");
-
                     let ra_ix = self.ra_ix(inst);
-                    let mut byte = [0u8; 1];
-                    match io::stdin().read(&mut byte) {
-                        Ok(1) => self.mem[ra_ix] = byte[0] as L3Value,
-                        _     => self.mem[ra_ix] = -1
-                    };
+                    self.mem[ra_ix] = self.read_byte();
                     pc += 1;
                 }
                 BWRI => {
-                    use std::io::Write;
-
-                    let byte = [self.ra(inst) as u8; 1];
-                    io::stdout().write(&byte).expect("write error");
+                    let byte = self.ra(inst);
+                    self.write_byte(byte);
+                    pc += 1;
+                }
+                BLKR => {
+                    // Block elements are bytes, as tagged L3 integers,
+                    // and so is the number of bytes read
+                    let block_ix = address_to_index(self.rb(inst));
+                    let size = self.mem.block_size(block_ix) as usize;
+                    let mut bytes = vec![0u8; size];
+                    let count = self.read_bytes(&mut bytes);
+                    for (i, &byte) in bytes[..count].iter().enumerate() {
+                        self.mem[block_ix + i] = ((byte as L3Value) << 1) | 1;
+                    }
+                    let ra_ix = self.ra_ix(inst);
+                    self.mem[ra_ix] = ((count as L3Value) << 1) | 1;
+                    pc += 1;
+                }
+                BLKW => {
+                    let block_ix = address_to_index(self.ra(inst));
+                    let size = self.mem.block_size(block_ix) as usize;
+                    let bytes: Vec<u8> = (0..size)
+                        .map(|i| (self.mem[block_ix + i] >> 1) as u8)
+                        .collect();
+                    self.output.write_all(&bytes).expect("write error");
                     pc += 1;
                 }
                 _ =>
@@ -0,0 +1,184 @@
+use std::fs::File;
+use std::io::{BufReader, BufRead};
+use std::ops::Index;
+use std::os::raw::{c_int, c_long, c_void};
+use std::os::unix::io::AsRawFd;
+use std::ptr;
+use std::slice;
+
+use L3Value;
+
+// Binary executable files (see vm/src/executable.h for their format)
+
+const EXECUTABLE_MAGIC   : u32 = 0x1A58334C; // "L3X" and 0x1A
+const EXECUTABLE_VERSION : u32 = 2;
+const HEADER_WORDS       : usize = 8;
+
+const HEADER_VERSION     : usize = 1;
+const HEADER_CODE_OFFSET : usize = 2;
+const HEADER_CODE_SIZE   : usize = 3;
+const HEADER_SYMBOLS_OFFSET : usize = 4;
+const HEADER_SYMBOLS_COUNT  : usize = 5;
+const HEADER_CHECKSUM    : usize = 6;
+
+const PROT_READ   : c_int = 1;
+const MAP_PRIVATE : c_int = 2;
+
+extern "C" {
+    fn mmap(addr: *mut c_void, len: usize, prot: c_int, flags: c_int,
+            fd: c_int, offset: c_long) -> *mut c_void;
+    fn munmap(addr: *mut c_void, len: usize) -> c_int;
+}
+
+enum Storage {
+    Loaded { _code: Vec<L3Value> }, // only owns the parsed code
+    Mapped(*mut c_void, usize),
+}
+
+/// The code of a program, either parsed from an assembly file or
+/// mapped read-only from an executable file, and then shared with all
+/// the processes running it.
+pub struct Program {
+    code: *const L3Value,
+    len: usize,
+    storage: Storage,
+}
+
+// FNV-1a hash of all the words of the file, the checksum counting as 0
+fn checksum(words: &[u32]) -> u32 {
+    words.iter().enumerate().fold(2166136261u32, |h, (i, &w)| {
+        let w = if i == HEADER_CHECKSUM { 0 } else { u32::from_le(w) };
+        (h ^ w).wrapping_mul(16777619)
+    })
+}
+
+// Number of words of the symbol at the given word index, or 0 if it
+// does not fit in the words before end
+fn symbol_words(words: &[u32], index: usize, end: usize) -> usize {
+    if end - index < 2 {
+        return 0
+    }
+    let name_length = u32::from_le(words[index + 1]) as usize;
+    if name_length > (end - index - 2) * 4 {
+        return 0
+    }
+    2 + (name_length + 3) / 4
+}
+
+impl Program {
+    pub fn load(file_name: &str) -> Program {
+        let file = File::open(file_name)
+            .unwrap_or_else(|_| panic!("cannot open file {}", file_name));
+        match Program::map(file_name, &file) {
+            Some(program) => program,
+            None => Program::parse(file_name, file),
+        }
+    }
+
+    /// Size of the code, in instructions
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    fn parse(file_name: &str, file: File) -> Program {
+        let mut code = Vec::new();
+        for maybe_line in BufReader::new(file).lines() {
+            let line = maybe_line
+                .unwrap_or_else(|_| panic!("error while reading file {}",
+                                           file_name));
+            match u32::from_str_radix(&line[0..8], 16) {
+                Ok(instr) => code.push(instr as L3Value),
+                Err(_) => panic!("cannot parse line: <{}>", line),
+            }
+        }
+        Program { code: code.as_ptr(), len: code.len(),
+                  storage: Storage::Loaded { _code: code } }
+    }
+
+    fn map(file_name: &str, file: &File) -> Option<Program> {
+        if cfg!(target_endian = "big") {
+            panic!("executable files are only supported on little-endian \
+                    hosts")
+        }
+        let size = file.metadata()
+            .unwrap_or_else(|_| panic!("cannot read file {}", file_name))
+            .len() as usize;
+        if size < HEADER_WORDS * 4 {
+            return None
+        }
+
+        let mapping = unsafe {
+            mmap(ptr::null_mut(), size, PROT_READ, MAP_PRIVATE,
+                 file.as_raw_fd(), 0)
+        };
+        if mapping as isize == -1 {
+            panic!("cannot map file {}", file_name)
+        }
+        let words = unsafe {
+            slice::from_raw_parts(mapping as *const u32, size / 4)
+        };
+        let storage = Storage::Mapped(mapping, size);
+        if u32::from_le(words[0]) != EXECUTABLE_MAGIC {
+            drop(Program { code: ptr::null(), len: 0, storage: storage });
+            return None
+        }
+
+        let header = |i: usize| u32::from_le(words[i]) as usize;
+        if header(HEADER_VERSION) != EXECUTABLE_VERSION as usize {
+            panic!("unsupported version {} of executable file {} \
+                    (expected {})",
+                   header(HEADER_VERSION), file_name, EXECUTABLE_VERSION)
+        }
+        let code_index = header(HEADER_CODE_OFFSET) / 4;
+        let len = header(HEADER_CODE_SIZE);
+        if size % 4 != 0
+            || header(HEADER_CODE_OFFSET) % 4 != 0
+            || code_index < HEADER_WORDS
+            || code_index > words.len()
+            || len > words.len() - code_index {
+            panic!("invalid executable file {}", file_name)
+        }
+        let symbols_offset = header(HEADER_SYMBOLS_OFFSET);
+        if symbols_offset % 4 != 0
+            || (symbols_offset != 0
+                && (symbols_offset / 4 < HEADER_WORDS
+                    || symbols_offset > size)) {
+            panic!("invalid executable file {}", file_name)
+        }
+        let expected_checksum = u32::from_le(words[HEADER_CHECKSUM]);
+        if checksum(words) != expected_checksum {
+            panic!("invalid checksum in executable file {}", file_name)
+        }
+        if symbols_offset != 0 {
+            let mut index = symbols_offset / 4;
+            for _ in 0..header(HEADER_SYMBOLS_COUNT) {
+                let length = symbol_words(words, index, words.len());
+                if length == 0 {
+                    panic!("invalid symbol table in executable file {}",
+                           file_name)
+                }
+                index += length;
+            }
+        }
+
+        Some(Program { code: words[code_index..].as_ptr() as *const L3Value,
+                       len: len,
+                       storage: storage })
+    }
+}
+
+impl Index<usize> for Program {
+    type Output = L3Value;
+    fn index(&self, i: usize) -> &Self::Output {
+        assert!(i < self.len, "invalid code index: {}", i);
+        unsafe { &*self.code.offset(i as isize) }
+    }
+}
+
+impl Drop for Program {
+    fn drop(&mut self) {
+        if let Storage::Mapped(mapping, size) = self.storage {
+            unsafe { munmap(mapping, size); }
+        }
+    }
+}
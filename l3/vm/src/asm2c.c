@@ -0,0 +1,407 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vmtypes.h"
+#include "opcode.h"
+#include "instr.h"
+#include "fail.h"
+
+/* Ahead-of-time translator from L3VM assembly files to C.
+ *
+ * The code is split into functions: the instructions reachable from an
+ * entry point without going through a call, return or halt. Each one
+ * is translated to a C function, in which jumps are direct gotos. The
+ * C function can be entered at its first instruction and at the
+ * instructions following calls, which are the return addresses. See
+ * asm2c_runtime.h for the calling convention.
+ */
+
+typedef struct {
+  instr_t* instrs;
+  size_t size;
+  size_t capacity;
+} code_t;
+
+// ASM file loading
+
+static void load_file(char* file_name, code_t* code) {
+  FILE* file = fopen(file_name, "r");
+  if (file == NULL)
+    fail("cannot open file %s", file_name);
+
+  char line[1000];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    instr_t instr;
+    int read_count = sscanf(line, "%8x", &instr);
+    if (read_count != 1)
+      fail("error while reading file %s", file_name);
+
+    if (code->size == code->capacity) {
+      code->capacity = code->capacity == 0 ? 1024 : 2 * code->capacity;
+      code->instrs = realloc(code->instrs, code->capacity * sizeof(instr_t));
+      if (code->instrs == NULL)
+        fail("cannot allocate memory for code");
+    }
+    code->instrs[code->size++] = instr;
+  }
+
+  fclose(file);
+}
+
+// Control flow
+
+static size_t jump_target(instr_t instr, size_t index) {
+  ptrdiff_t target = (ptrdiff_t)index;
+  if (instr_opcode(instr) == opcode_JI)
+    target += instr_extract_s(instr, 0, 26);
+  else
+    target += instr_d(instr);
+  return (size_t)target;
+}
+
+static bool is_jump(opcode_t opcode) {
+  switch (opcode) {
+  case opcode_JLT: case opcode_JLE: case opcode_JEQ: case opcode_JNE:
+  case opcode_JLTI: case opcode_JLEI: case opcode_JGTI: case opcode_JGEI:
+  case opcode_JEQI: case opcode_JNEI:
+  case opcode_JI:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool falls_through(opcode_t opcode) {
+  switch (opcode) {
+  case opcode_JI: case opcode_TCAL: case opcode_RET: case opcode_HALT:
+    return false;
+  default:
+    return true;
+  }
+}
+
+/* Assign all instructions reachable from entry to the given function.
+   Return false if the code jumps outside of the code area. */
+static bool explore_function(const code_t* code,
+                             size_t entry,
+                             size_t function,
+                             size_t function_of[],
+                             size_t worklist[]) {
+  size_t worklist_size = 0;
+  worklist[worklist_size++] = entry;
+  while (worklist_size > 0) {
+    size_t index = worklist[--worklist_size];
+    if (index >= code->size)
+      return false;
+    if (function_of[index] != SIZE_MAX)
+      continue;
+    function_of[index] = function;
+
+    instr_t instr = code->instrs[index];
+    opcode_t opcode = instr_opcode(instr);
+    if (is_jump(opcode))
+      worklist[worklist_size++] = jump_target(instr, index);
+    if (falls_through(opcode))
+      worklist[worklist_size++] = index + 1;
+  }
+  return true;
+}
+
+// C code generation
+
+static void print_reg(FILE* out, reg_id_t r) {
+  reg_bank_t bank = reg_bank(r);
+  unsigned int index = reg_index(r);
+  switch (bank) {
+  case Ib: fprintf(out, "Ib[%u]", index); break;
+  case Ob: fprintf(out, "Ob[%u]", index); break;
+  default: fprintf(out, "Lb[%u]", (unsigned int)(bank - Lb) * 32 + index); break;
+  }
+}
+
+/* Print an assignment to register a of the expression format, in which
+   $b and $c stand for registers b and c, and $s for the constant of
+   register-immediate instructions. */
+static void print_arith(FILE* out, instr_t instr, char* format) {
+  fprintf(out, "  ");
+  print_reg(out, instr_ra(instr));
+  fprintf(out, " = ");
+  for (char* c = format; *c != '\0'; ++c) {
+    if (c[0] == '$' && c[1] == 'b') {
+      print_reg(out, instr_rb(instr));
+      ++c;
+    } else if (c[0] == '$' && c[1] == 'c') {
+      print_reg(out, instr_rc(instr));
+      ++c;
+    } else if (c[0] == '$' && c[1] == 's') {
+      fprintf(out, "(uvalue_t)%d", instr_s(instr));
+      ++c;
+    } else
+      fputc(*c, out);
+  }
+  fprintf(out, ";\n");
+}
+
+static void print_cond_jump(FILE* out,
+                            instr_t instr,
+                            size_t index,
+                            char* cast,
+                            char* op) {
+  fprintf(out, "  if (%s", cast);
+  print_reg(out, instr_ra(instr));
+  fprintf(out, " %s %s", op, cast);
+  print_reg(out, instr_rb(instr));
+  fprintf(out, ") goto l_%zu;\n", jump_target(instr, index));
+}
+
+static void print_cond_jump_imm(FILE* out,
+                                instr_t instr,
+                                size_t index,
+                                char* op) {
+  fprintf(out, "  if ((value_t)");
+  print_reg(out, instr_ra(instr));
+  fprintf(out, " %s %d) goto l_%zu;\n",
+          op, instr_jump_s(instr), jump_target(instr, index));
+}
+
+static void print_instr(FILE* out, instr_t instr, size_t index) {
+  uvalue_t next_pc = (uvalue_t)((index + 1) * sizeof(instr_t));
+
+  switch (instr_opcode(instr)) {
+  case opcode_ADD: print_arith(out, instr, "$b + $c"); break;
+  case opcode_SUB: print_arith(out, instr, "$b - $c"); break;
+  case opcode_MUL: print_arith(out, instr, "$b * $c"); break;
+  case opcode_DIV:
+    print_arith(out, instr, "(uvalue_t)((value_t)$b / (value_t)$c)");
+    break;
+  case opcode_MOD:
+    print_arith(out, instr, "(uvalue_t)((value_t)$b % (value_t)$c)");
+    break;
+  case opcode_LSL: print_arith(out, instr, "$b << ($c & 0x1F)"); break;
+  case opcode_LSR: print_arith(out, instr, "$b >> ($c & 0x1F)"); break;
+  case opcode_AND: print_arith(out, instr, "$b & $c"); break;
+  case opcode_OR: print_arith(out, instr, "$b | $c"); break;
+  case opcode_XOR: print_arith(out, instr, "$b ^ $c"); break;
+  case opcode_ADDI: print_arith(out, instr, "$b + $s"); break;
+  case opcode_SUBI: print_arith(out, instr, "$b - $s"); break;
+  case opcode_LSLI: print_arith(out, instr, "$b << ($s & 0x1F)"); break;
+  case opcode_LSRI: print_arith(out, instr, "$b >> ($s & 0x1F)"); break;
+  case opcode_ANDI: print_arith(out, instr, "$b & $s"); break;
+  case opcode_ORI: print_arith(out, instr, "$b | $s"); break;
+
+  case opcode_JLT: print_cond_jump(out, instr, index, "(value_t)", "<"); break;
+  case opcode_JLE: print_cond_jump(out, instr, index, "(value_t)", "<="); break;
+  case opcode_JEQ: print_cond_jump(out, instr, index, "", "=="); break;
+  case opcode_JNE: print_cond_jump(out, instr, index, "", "!="); break;
+  case opcode_JLTI: print_cond_jump_imm(out, instr, index, "<"); break;
+  case opcode_JLEI: print_cond_jump_imm(out, instr, index, "<="); break;
+  case opcode_JGTI: print_cond_jump_imm(out, instr, index, ">"); break;
+  case opcode_JGEI: print_cond_jump_imm(out, instr, index, ">="); break;
+  case opcode_JEQI: print_cond_jump_imm(out, instr, index, "=="); break;
+  case opcode_JNEI: print_cond_jump_imm(out, instr, index, "!="); break;
+  case opcode_JI:
+    fprintf(out, "  goto l_%zu;\n", jump_target(instr, index));
+    break;
+
+  case opcode_TCAL:
+    fprintf(out, "  return rt_tail_call(");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, ");\n");
+    break;
+  case opcode_CALL:
+    fprintf(out, "  return rt_call(");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, ", %uu);\n", next_pc);
+    break;
+  case opcode_RET:
+    fprintf(out, "  return rt_ret();\n");
+    break;
+  case opcode_HALT:
+    fprintf(out, "  halt_code = ");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, ";\n  return HALT_PC;\n");
+    break;
+
+  case opcode_LDLO:
+    fprintf(out, "  ");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, " = (uvalue_t)%d;\n", instr_extract_s(instr, 0, 18));
+    break;
+  case opcode_LDHI:
+    fprintf(out, "  ");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, " = 0x%08xu | (", instr_extract_u(instr, 0, 16) << 16);
+    print_reg(out, instr_ra(instr));
+    fprintf(out, " & 0xFFFF);\n");
+    break;
+  case opcode_MOVE: print_arith(out, instr, "$b"); break;
+
+  case opcode_RALO: {
+    static char* bases[] = { "Lb", "Ib", "Ob", NULL };
+    char* base = bases[instr_extract_u(instr, 24, 2)];
+    if (base == NULL)
+      fail("invalid base register in instruction %zu", index);
+    fprintf(out, "  %s = memory_allocate(tag_RegisterFrame, %u);\n",
+            base, instr_extract_u(instr, 16, 8));
+  } break;
+  case opcode_BALO:
+    fprintf(out, "  { uvalue_t block = rt_block_alloc((tag_t)%u, ",
+            instr_extract_u(instr, 2, 8));
+    print_reg(out, instr_rb(instr));
+    fprintf(out, "); ");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, " = block; }\n");
+    break;
+  case opcode_BSIZ:
+    print_arith(out, instr, "memory_get_block_size(rt_block($b))");
+    break;
+  case opcode_BTAG:
+    print_arith(out, instr, "memory_get_block_tag(rt_block($b))");
+    break;
+  case opcode_BGET: print_arith(out, instr, "rt_block($b)[$c]"); break;
+  case opcode_BSET:
+    fprintf(out, "  rt_block_set(");
+    print_reg(out, instr_rb(instr));
+    fprintf(out, ", ");
+    print_reg(out, instr_rc(instr));
+    fprintf(out, ", ");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, ");\n");
+    break;
+
+  case opcode_BREA:
+    fprintf(out, "  ");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, " = rt_byte_read();\n");
+    break;
+  case opcode_BWRI:
+    fprintf(out, "  rt_byte_write(");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, ");\n");
+    break;
+  case opcode_BLKR:
+    print_arith(out, instr, "rt_block_read($b)");
+    break;
+  case opcode_BLKW:
+    fprintf(out, "  rt_block_write(");
+    print_reg(out, instr_ra(instr));
+    fprintf(out, ");\n");
+    break;
+
+  default:
+    fail("invalid opcode %d in instruction %zu", instr_opcode(instr), index);
+  }
+}
+
+static void print_function(FILE* out,
+                           const code_t* code,
+                           size_t function,
+                           const size_t function_of[],
+                           const bool is_entry[],
+                           const bool is_label[]) {
+  fprintf(out, "\nstatic uvalue_t f_%zu(uvalue_t pc) {\n", function);
+  fprintf(out, "  switch (pc) {\n");
+  for (size_t i = 0; i < code->size; ++i) {
+    if (function_of[i] == function && is_entry[i])
+      fprintf(out, "  case %zuu: goto l_%zu;\n", i * sizeof(instr_t), i);
+  }
+  fprintf(out, "  default: fail(\"invalid code address %%u\", pc);\n");
+  fprintf(out, "  }\n\n");
+
+  size_t prev = SIZE_MAX;
+  for (size_t i = 0; i < code->size; ++i) {
+    if (function_of[i] != function)
+      continue;
+    if (prev != SIZE_MAX && prev + 1 != i
+        && falls_through(instr_opcode(code->instrs[prev])))
+      fprintf(out, "  goto l_%zu;\n", prev + 1);
+    if (is_label[i])
+      fprintf(out, " l_%zu:\n", i);
+    print_instr(out, code->instrs[i], i);
+    prev = i;
+  }
+  fprintf(out, "}\n");
+}
+
+static void translate(char* asm_file_name, const code_t* code, FILE* out) {
+  size_t* function_of = malloc(code->size * sizeof(size_t));
+  size_t* worklist = malloc((2 * code->size + 1) * sizeof(size_t));
+  bool* is_entry = calloc(code->size, sizeof(bool));
+  bool* is_label = calloc(code->size, sizeof(bool));
+  if (function_of == NULL || worklist == NULL
+      || is_entry == NULL || is_label == NULL)
+    fail("cannot allocate memory for translation");
+
+  // Split the code into functions
+  size_t functions_count = 0;
+  for (size_t i = 0; i < code->size; ++i)
+    function_of[i] = SIZE_MAX;
+  for (size_t i = 0; i < code->size; ++i) {
+    if (function_of[i] != SIZE_MAX)
+      continue;
+    if (!explore_function(code, i, functions_count, function_of, worklist))
+      fail("instruction %zu jumps outside of the code", i);
+    is_entry[i] = true;
+    functions_count += 1;
+  }
+
+  // Find entry points and jump targets
+  for (size_t i = 0; i < code->size; ++i) {
+    instr_t instr = code->instrs[i];
+    opcode_t opcode = instr_opcode(instr);
+    if (opcode == opcode_CALL && i + 1 < code->size)
+      is_entry[i + 1] = true;
+    if (is_jump(opcode))
+      is_label[jump_target(instr, i)] = true;
+  }
+  for (size_t i = 0; i < code->size; ++i) {
+    if (is_entry[i])
+      is_label[i] = true;
+    if (i > 0 && function_of[i - 1] != function_of[i]
+        && falls_through(instr_opcode(code->instrs[i - 1])))
+      fail("instruction %zu falls through to another function", i - 1);
+  }
+
+  fprintf(out, "/* Generated by asm2c from %s. Do not edit. */\n\n",
+          asm_file_name);
+  fprintf(out, "#include \"asm2c_runtime.h\"\n");
+
+  for (size_t f = 0; f < functions_count; ++f)
+    fprintf(out, "static uvalue_t f_%zu(uvalue_t pc);\n", f);
+  for (size_t f = 0; f < functions_count; ++f)
+    print_function(out, code, f, function_of, is_entry, is_label);
+
+  fprintf(out, "\nconst size_t program_code_size = %zu;\n", code->size);
+  fprintf(out, "\nconst program_function_t program_functions[] = {\n");
+  for (size_t i = 0; i < code->size; ++i) {
+    if (is_entry[i])
+      fprintf(out, "  [%zu] = f_%zu,\n", i, function_of[i]);
+  }
+  fprintf(out, "  [%zu] = NULL\n};\n", code->size);
+
+  free(is_label);
+  free(is_entry);
+  free(worklist);
+  free(function_of);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    printf("Usage: %s <asm_file> <c_file>\n", argv[0]);
+    fail("invalid arguments");
+  }
+
+  code_t code = { NULL, 0, 0 };
+  load_file(argv[1], &code);
+
+  FILE* out = fopen(argv[2], "w");
+  if (out == NULL)
+    fail("cannot open file %s", argv[2]);
+  translate(argv[1], &code, out);
+  fclose(out);
+
+  free(code.instrs);
+  return 0;
+}
@@ -0,0 +1,69 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdalign.h>
+
+#include "asm2c_runtime.h"
+#include "engine.h"
+
+char* memory_start;
+uvalue_t* Lb;
+uvalue_t* Ib;
+uvalue_t* Ob;
+uvalue_t halt_code;
+uint8_t* card_table;
+
+// Base registers, used by the garbage collector
+
+uvalue_t* engine_get_Lb(void) { return Lb; }
+uvalue_t* engine_get_Ib(void) { return Ib; }
+uvalue_t* engine_get_Ob(void) { return Ob; }
+
+/* Translated programs allocate all frames in the heap */
+uvalue_t* engine_get_frames_start(void) { return NULL; }
+uvalue_t* engine_get_frames_top(void) { return NULL; }
+bool engine_has_liveness(void) { return false; }
+void engine_for_each_live_register(void (*f)(uvalue_t* reg)) { (void)f; }
+
+void engine_set_Lb(uvalue_t* new_value) { Lb = new_value; }
+void engine_set_Ib(uvalue_t* new_value) { Ib = new_value; }
+void engine_set_Ob(uvalue_t* new_value) { Ob = new_value; }
+
+int main(int argc, char* argv[]) {
+  size_t memory_size = 1000000;
+  if (argc == 3 && strcmp(argv[1], "-m") == 0)
+    memory_size = strtoul(argv[2], NULL, 10);
+  else if (argc != 1)
+    fail("usage: %s [-m <size>]", argv[0]);
+
+  io_setup();
+
+  const size_t value_align = alignof(value_t);
+  memory_setup(memory_size & ~(value_align - 1));
+  card_table = memory_get_card_table();
+
+  /* The code is not loaded, but its addresses are kept free so that
+     code and block addresses are the same as in the interpreter. */
+  memory_start = memory_get_start();
+  size_t code_byte_size = program_code_size * sizeof(instr_t);
+  if (code_byte_size >= memory_size)
+    fail("not enough memory to load code");
+  memory_set_heap_start(memory_start + code_byte_size);
+
+  engine_set_Lb(memory_get_start());
+  engine_set_Ib(memory_get_start());
+  engine_set_Ob(memory_get_start());
+
+  uvalue_t pc = 0;
+  while (pc != HALT_PC) {
+    size_t index = pc / sizeof(instr_t);
+    if (pc % sizeof(instr_t) != 0
+        || index >= program_code_size
+        || program_functions[index] == NULL)
+      fail("invalid code address %u", pc);
+    pc = program_functions[index](pc);
+  }
+
+  io_flush();
+  memory_cleanup();
+  return (int)halt_code;
+}
@@ -0,0 +1,108 @@
+#ifndef ASM2C_RUNTIME_H
+#define ASM2C_RUNTIME_H
+
+#include "vmtypes.h"
+#include "memory.h"
+#include "io.h"
+#include "fail.h"
+
+/* Runtime support for programs translated to C by asm2c.
+ *
+ * Each L3 function is translated to a C function taking the (virtual)
+ * code address at which it must start, and returning the code address
+ * of the next function to run, or HALT_PC. Calls and returns go
+ * through a trampoline, so that deep recursion and tail calls do not
+ * grow the C stack.
+ */
+
+#define HALT_PC UINT32_MAX
+
+typedef uvalue_t (*program_function_t)(uvalue_t pc);
+
+/* Defined by the translated program */
+extern const size_t program_code_size;              /* in instructions */
+extern const program_function_t program_functions[]; /* per instruction */
+
+/* Defined by the runtime */
+extern char* memory_start;
+extern uvalue_t* Lb;
+extern uvalue_t* Ib;
+extern uvalue_t* Ob;
+extern uvalue_t halt_code;
+extern uint8_t* card_table;
+
+static inline void* addr_v_to_p(uvalue_t v_addr) {
+  return memory_start + v_addr;
+}
+
+static inline uvalue_t addr_p_to_v(void* p_addr) {
+  return (uvalue_t)((char*)p_addr - memory_start);
+}
+
+static inline uvalue_t rt_tail_call(uvalue_t target_pc) {
+  Ob[0] = Ib[0];
+  Ob[1] = Ib[1];
+  Ob[2] = Ib[2];
+  Ob[3] = Ib[3];
+  Ib = Ob;
+  Lb = (uvalue_t*)memory_start;
+  Ob = (uvalue_t*)memory_start;
+  return target_pc;
+}
+
+static inline uvalue_t rt_call(uvalue_t target_pc, uvalue_t return_pc) {
+  Ob[0] = addr_p_to_v(Ib);
+  Ob[1] = addr_p_to_v(Lb);
+  Ob[2] = addr_p_to_v(Ob);
+  Ob[3] = return_pc;
+  Ib = Ob;
+  Lb = (uvalue_t*)memory_start;
+  Ob = (uvalue_t*)memory_start;
+  return target_pc;
+}
+
+static inline uvalue_t rt_ret(void) {
+  uvalue_t ret_value = Ib[4];
+  uvalue_t target_pc = Ib[3];
+  Ob = addr_v_to_p(Ib[2]);
+  Lb = addr_v_to_p(Ib[1]);
+  Ib = addr_v_to_p(Ob[0]);
+  Ob[0] = ret_value;
+  return target_pc;
+}
+
+static inline uvalue_t rt_block_alloc(tag_t tag, uvalue_t size) {
+  return addr_p_to_v(memory_allocate(tag, size));
+}
+
+static inline uvalue_t* rt_block(uvalue_t v_addr) {
+  return addr_v_to_p(v_addr);
+}
+
+static inline void rt_block_set(uvalue_t v_addr,
+                                uvalue_t index,
+                                uvalue_t value) {
+  memory_mark_card(card_table, v_addr + index * (uvalue_t)sizeof(uvalue_t));
+  rt_block(v_addr)[index] = value;
+}
+
+static inline uvalue_t rt_byte_read(void) {
+  return (uvalue_t)io_read_byte();
+}
+
+static inline void rt_byte_write(uvalue_t value) {
+  io_write_byte((uint8_t)value);
+}
+
+static inline uvalue_t rt_block_read(uvalue_t v_addr) {
+  uvalue_t* block = rt_block(v_addr);
+  uvalue_t count = io_read_block(block, memory_get_block_size(block));
+  return (count << 1) | 1;
+}
+
+static inline void rt_block_write(uvalue_t v_addr) {
+  uvalue_t* block = rt_block(v_addr);
+  io_write_block(block, memory_get_block_size(block));
+}
+
+#endif // ASM2C_RUNTIME_H
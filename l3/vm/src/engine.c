@@ -1,29 +1,98 @@
 #include <assert.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "vmtypes.h"
 #include "engine.h"
 #include "opcode.h"
+#include "instr.h"
+#include "io.h"
+#include "jit.h"
 #include "memory.h"
+#include "sampler.h"
+#include "heap_profiler.h"
 #include "fail.h"
 
-typedef enum {
-  Lb, Lb1, Lb2, Lb3, Lb4, Lb5,
-  Ib, Ob
-} reg_bank_t;
-
 static void* memory_start;
 static void* memory_end;
 
 static uvalue_t* R[8];          /* (pseudo)base registers */
+static uint8_t* card_table;     /* of the write barrier, or NULL */
+static memory_buffer_t* alloc_buffer; /* in which blocks are allocated inline */
+
+/* Pre-decoded instruction, used for direct threading. The operands of
+   the original instruction are extracted once, when the code is
+   translated, and the opcode is replaced by the address of its
+   handler in engine_run. */
+typedef struct {
+  void* handler;
+  uint8_t ra_bank, ra_index;
+  uint8_t rb_bank, rb_index;
+  uint8_t rc_bank, rc_index;
+  value_t imm;                  /* displacement, constant, size or tag */
+  value_t jump_imm;             /* constant compared by immediate jumps */
+} decoded_instr_t;
+
+/* Register-frame stack. Frames allocated by RALO are pushed on it,
+   and popped by RET and TCAL. When it is full, frames are allocated in
+   the heap instead. Frames on the stack have the same header as heap
+   blocks. */
+static uvalue_t* frames_start;
+static uvalue_t* frames_top;
+static uvalue_t* frames_end;
+
+/* Raw code, either loaded at the start of the memory or used in place
+   (e.g. mapped from an executable file). In the latter case, the
+   start of the memory is only reserved for the code addresses. */
+static const instr_t* raw_code;
+static size_t code_size;        /* in instructions */
+static decoded_instr_t* code;   /* pre-decoded copy of the code area */
+
+/* Number of calls after which a function is compiled to native code */
+#define JIT_HOT_THRESHOLD 1000
+
+static bool jit_enabled;
+static uint32_t* jit_call_counts; /* calls per target instruction */
+static jit_code_t* jit_entries;   /* native code per instruction, or NULL */
+static void* jit_enter_label;     /* handler entering native code */
 
 void engine_setup(void) {
   memory_start = memory_get_start();
   memory_end = memory_get_end();
+  card_table = memory_get_card_table();
+  alloc_buffer = memory_get_buffer();
+  raw_code = memory_start;
+  code_size = 0;
 }
 
+#ifdef ENGINE_PROFILE
+static void profile_cleanup(void);
+#endif
+static char* sample_file_name;  /* of the sampling profiler, or NULL */
+static void sample_cleanup(void);
+static void liveness_cleanup(void);
+
 void engine_cleanup(void) {
-  // nothing to do
+  sample_cleanup();
+  liveness_cleanup();
+  if (jit_enabled)
+    jit_cleanup();
+  free(jit_entries);
+  free(jit_call_counts);
+  free(code);
+#ifdef ENGINE_PROFILE
+  profile_cleanup();
+#endif
+  jit_entries = NULL;
+  jit_call_counts = NULL;
+  code = NULL;
+}
+
+void engine_enable_jit(void) {
+  jit_enabled = true;
 }
 
 void engine_emit(instr_t instr, instr_t** instr_ptr) {
@@ -31,8 +100,31 @@ void engine_emit(instr_t instr, instr_t** instr_ptr) {
     fail("not enough memory to load code");
   **instr_ptr = instr;
   *instr_ptr += 1;
+  size_t emitted_size = (size_t)(*instr_ptr - (instr_t*)memory_start);
+  if (emitted_size > code_size)
+    code_size = emitted_size;
 }
 
+void* engine_use_code(const instr_t* instrs, size_t size) {
+  instr_t* reserved_end = (instr_t*)memory_start + size;
+  if ((void*)reserved_end > memory_end)
+    fail("not enough memory to load code");
+  raw_code = instrs;
+  code_size = size;
+  return reserved_end;
+}
+
+void* engine_setup_frames(void* start, size_t byte_size) {
+  frames_start = frames_top = start;
+  frames_end = frames_start + byte_size / sizeof(uvalue_t);
+  if ((void*)frames_end > memory_end)
+    fail("not enough memory for the register-frame stack");
+  return frames_end;
+}
+
+uvalue_t* engine_get_frames_start(void) { return frames_start; }
+uvalue_t* engine_get_frames_top(void) { return frames_top; }
+
 uvalue_t* engine_get_Lb(void) { return R[Lb]; }
 uvalue_t* engine_get_Ib(void) { return R[Ib]; }
 uvalue_t* engine_get_Ob(void) { return R[Ob]; }
@@ -55,62 +147,923 @@ static uvalue_t addr_p_to_v(void* p_addr) {
   return (uvalue_t)((char*)p_addr - (char*)memory_start);
 }
 
-// Instruction decoding
+// Register-frame stack
+
+static bool is_stack_frame(uvalue_t* frame) {
+  return frames_start < frame && frame <= frames_end;
+}
+
+static uvalue_t* stack_frame_end(uvalue_t* frame) {
+  return frame + (frame[-1] >> 8);
+}
+
+static uvalue_t* frame_allocate(uvalue_t size) {
+  if (size < (uvalue_t)(frames_end - frames_top)) {
+    uvalue_t* frame = frames_top + 1;
+    frame[-1] = (size << 8) | tag_RegisterFrame;
+    frames_top = frame + size;
+    return frame;
+  } else
+    return memory_buffer_allocate(alloc_buffer, tag_RegisterFrame, size);
+}
+
+/* Return the end of the highest stack frame of the caller of the
+   function whose input frame is in_frame, or NULL if none of them is
+   on the stack. The frames of the caller are the ones saved in the
+   first three registers of the input frame by CALL, and copied by
+   TCAL. The input frame itself is the output frame of the caller only
+   after CALL: after TCAL, it is the dead input frame of the function
+   which tail-called. */
+static uvalue_t* frames_caller_top(uvalue_t* in_frame) {
+  if ((void*)in_frame == memory_start)
+    return NULL;
+
+  uvalue_t* frames[3] = {
+    addr_v_to_p(in_frame[0]),
+    addr_v_to_p(in_frame[1]),
+    addr_v_to_p(in_frame[2])
+  };
+  uvalue_t* top = NULL;
+  for (size_t i = 0; i < 3; ++i) {
+    if (is_stack_frame(frames[i]) && stack_frame_end(frames[i]) > top)
+      top = stack_frame_end(frames[i]);
+  }
+  return top;
+}
+
+/* Pop the frames of the function returning to its caller. */
+static void frames_pop_return(uvalue_t* in_frame) {
+  uvalue_t* top = frames_caller_top(in_frame);
+  if (top != NULL)
+    frames_top = top;
+}
+
+/* Pop the frames of the function tail-calling another one, moving its
+   output frame (the input frame of the callee) down to the top of its
+   caller's frames. Return the (possibly moved) output frame. */
+static uvalue_t* frames_pop_tail_call(uvalue_t* in_frame,
+                                      uvalue_t* out_frame) {
+  uvalue_t* top = frames_caller_top(in_frame);
+  if (top == NULL)
+    return out_frame;
+
+  if (is_stack_frame(out_frame)) {
+    uvalue_t* new_out_frame = top + 1;
+    if (new_out_frame < out_frame) {
+      size_t size = (out_frame[-1] >> 8) + 1;
+      memmove(new_out_frame - 1, out_frame - 1, size * sizeof(uvalue_t));
+      out_frame = new_out_frame;
+    }
+    frames_top = stack_frame_end(out_frame);
+  } else
+    frames_top = top;
+  return out_frame;
+}
+
+// Liveness maps
+
+/* Registers live after a call, as a bitmap indexed by the numbers of
+   the registers in instructions (Lb registers first, then Ib ones) */
+#define LIVENESS_WORDS (256 / VALUE_BITS)
+#define LIVENESS_IB_FIRST 192
+
+typedef struct {
+  uvalue_t return_address;
+  uvalue_t live[LIVENESS_WORDS];
+} liveness_t;
+
+static liveness_t* liveness;    /* sorted by return address */
+static size_t liveness_count;
+static size_t liveness_capacity;
+
+static int liveness_compare(const void* v1, const void* v2) {
+  const liveness_t* l1 = v1;
+  const liveness_t* l2 = v2;
+  return (l1->return_address > l2->return_address)
+    - (l1->return_address < l2->return_address);
+}
+
+/* Checksum of the code, as written by the compiler in liveness maps */
+static uint32_t code_checksum(void) {
+  uint32_t hash = 2166136261u;  /* FNV-1a */
+  for (size_t i = 0; i < code_size; ++i) {
+    hash ^= raw_code[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+bool engine_load_liveness(char* file_name) {
+  FILE* file = fopen(file_name, "r");
+  if (file == NULL)
+    return false;
+
+  char line[2048];
+  unsigned int checksum;
+  if (fgets(line, sizeof(line), file) == NULL
+      || sscanf(line, "%8x", &checksum) != 1)
+    fail("error while reading file %s", file_name);
+  if (checksum != code_checksum()) {
+    fprintf(stderr, "warning: %s does not match the program, "
+            "frames are scanned entirely\n", file_name);
+    fclose(file);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (liveness_count == liveness_capacity) {
+      liveness_capacity = liveness_capacity == 0 ? 256 : 2 * liveness_capacity;
+      liveness = realloc(liveness, liveness_capacity * sizeof(liveness_t));
+      if (liveness == NULL)
+        fail("cannot allocate memory for liveness maps");
+    }
+    liveness_t* entry = &liveness[liveness_count++];
+    memset(entry, 0, sizeof(*entry));
+
+    char* end;
+    entry->return_address = (uvalue_t)strtoul(line, &end, 16);
+    if (end == line)
+      fail("error while reading file %s", file_name);
+    for (char* next = end; ; next = end) {
+      unsigned long reg = strtoul(next, &end, 10);
+      if (end == next)
+        break;
+      if (reg >= LIVENESS_WORDS * VALUE_BITS)
+        fail("invalid register %lu in file %s", reg, file_name);
+      entry->live[reg / VALUE_BITS] |= 1u << (reg % VALUE_BITS);
+    }
+  }
+  fclose(file);
+  qsort(liveness, liveness_count, sizeof(liveness_t), liveness_compare);
+  return true;
+}
+
+static void liveness_cleanup(void) {
+  free(liveness);
+  liveness = NULL;
+  liveness_count = liveness_capacity = 0;
+}
+
+bool engine_has_liveness(void) {
+  return liveness != NULL;
+}
+
+/* Return the registers live after the call returning to the given
+   address, or NULL if they are unknown */
+static const liveness_t* liveness_find(uvalue_t return_address) {
+  liveness_t key = { return_address, { 0 } };
+  return bsearch(&key, liveness, liveness_count, sizeof(liveness_t),
+                 liveness_compare);
+}
+
+/* Call f on the registers of the given frame from the first one on,
+   which are live according to the given map, or all of them if it is
+   NULL. The number of the register i of the frame is first_reg + i. */
+static void frame_for_each_register(uvalue_t* frame,
+                                    uvalue_t first,
+                                    const liveness_t* live,
+                                    unsigned int first_reg,
+                                    void (*f)(uvalue_t* reg)) {
+  if ((void*)frame == memory_start)
+    return;
+  uvalue_t size = frame[-1] >> 8;
+  for (uvalue_t i = first; i < size; ++i) {
+    unsigned int reg = first_reg + i;
+    if (live == NULL || (live->live[reg / VALUE_BITS] >> (reg % VALUE_BITS)) & 1)
+      f(&frame[i]);
+  }
+}
+
+void engine_for_each_live_register(void (*f)(uvalue_t* reg)) {
+  // The current function may use all the registers of its frames
+  frame_for_each_register(R[Lb], 0, NULL, 0, f);
+  frame_for_each_register(R[Ib], 0, NULL, LIVENESS_IB_FIRST, f);
+  frame_for_each_register(R[Ob], 0, NULL, 0, f);
+
+  // Its callers only use the registers live after their call, besides
+  // I0 to I2, which link them to their own caller. Their output frame
+  // is the input frame of their callee.
+  for (uvalue_t* frame = R[Ib]; frame != memory_start; ) {
+    const liveness_t* live = liveness_find(frame[3]);
+    uvalue_t* caller_in = addr_v_to_p(frame[0]);
+    frame_for_each_register(addr_v_to_p(frame[1]), 0, live, 0, f);
+    if ((void*)caller_in != memory_start) {
+      for (size_t i = 0; i < 3; ++i)
+        f(&caller_in[i]);
+    }
+    frame_for_each_register(caller_in, 3, live, LIVENESS_IB_FIRST, f);
+    frame = caller_in;
+  }
+}
+
+// Instruction pre-decoding
+
+static void decode_instr(instr_t instr, void* labels[], decoded_instr_t* d) {
+  opcode_t opcode = instr_opcode(instr);
+  if (opcode >= OPCODE_COUNT)
+    fail("invalid opcode %d", opcode);
+
+  d->handler = labels[opcode];
+  d->ra_bank = (uint8_t)reg_bank(instr_ra(instr));
+  d->ra_index = (uint8_t)reg_index(instr_ra(instr));
+  d->rb_bank = (uint8_t)reg_bank(instr_rb(instr));
+  d->rb_index = (uint8_t)reg_index(instr_rb(instr));
+  d->rc_bank = (uint8_t)reg_bank(instr_rc(instr));
+  d->rc_index = (uint8_t)reg_index(instr_rc(instr));
+  d->jump_imm = 0;
+
+  switch (opcode) {
+  case opcode_JLT: case opcode_JLE: case opcode_JEQ: case opcode_JNE:
+    d->imm = instr_d(instr);
+    break;
+  case opcode_JLTI: case opcode_JLEI: case opcode_JGTI: case opcode_JGEI:
+  case opcode_JEQI: case opcode_JNEI:
+    d->imm = instr_d(instr);
+    d->jump_imm = instr_jump_s(instr);
+    break;
+  case opcode_ADDI: case opcode_SUBI: case opcode_LSLI: case opcode_LSRI:
+  case opcode_ANDI: case opcode_ORI:
+    d->imm = instr_s(instr);
+    break;
+  case opcode_JI:
+    d->imm = instr_extract_s(instr, 0, 26);
+    break;
+  case opcode_LDLO:
+    d->imm = instr_extract_s(instr, 0, 18);
+    break;
+  case opcode_LDHI:
+    d->imm = (value_t)(instr_extract_u(instr, 0, 16) << 16);
+    break;
+  case opcode_RALO:
+    d->ra_bank = (uint8_t)instr_extract_u(instr, 24, 2);
+    d->imm = (value_t)instr_extract_u(instr, 16, 8);
+    break;
+  case opcode_BALO:
+    d->imm = (value_t)instr_extract_u(instr, 2, 8);
+    break;
+  default:
+    d->imm = 0;
+    break;
+  }
+}
+
+/* Superinstruction: a sequence of opcodes executed by a single
+   handler. The first opcodes of the sequence must not transfer
+   control, the last one can. */
+typedef struct {
+  opcode_t opcodes[3];
+  size_t length;
+  void* handler;
+} superinstr_t;
+
+static bool superinstr_matches(const superinstr_t* s,
+                               const instr_t* raw_instr,
+                               size_t remaining) {
+  if (s->length > remaining)
+    return false;
+  for (size_t i = 0; i < s->length; ++i) {
+    if (instr_opcode(raw_instr[i]) != s->opcodes[i])
+      return false;
+  }
+  return true;
+}
+
+static bool superinstr_allocates(const superinstr_t* s) {
+  for (size_t i = 0; i < s->length; ++i) {
+    if (s->opcodes[i] == opcode_BALO || s->opcodes[i] == opcode_RALO)
+      return true;
+  }
+  return false;
+}
 
-static reg_bank_t reg_bank(reg_id_t r) {
-  return r >> 5;
+static bool superinstr_calls(const superinstr_t* s) {
+  for (size_t i = 0; i < s->length; ++i) {
+    if (s->opcodes[i] == opcode_CALL || s->opcodes[i] == opcode_TCAL)
+      return true;
+  }
+  return false;
 }
 
-static unsigned int reg_index(reg_id_t r) {
-  return r & 0x1F;
+static bool superinstr_returns(const superinstr_t* s) {
+  for (size_t i = 0; i < s->length; ++i) {
+    if (s->opcodes[i] == opcode_RET)
+      return true;
+  }
+  return false;
 }
 
-static unsigned int instr_extract_u(instr_t instr, int start, int len) {
-  return (instr >> start) & ((1 << len) - 1);
+static void decode_code(void* labels[],
+                        const superinstr_t superinstrs[],
+                        size_t superinstrs_count) {
+  free(code);
+  code = calloc(code_size, sizeof(decoded_instr_t));
+  if (code == NULL && code_size > 0)
+    fail("cannot allocate memory for decoded code");
+
+  for (size_t i = 0; i < code_size; ++i)
+    decode_instr(raw_code[i], labels, &code[i]);
+
+  /* The following instructions of a sequence keep their own handler,
+     so that jumping into the middle of a sequence remains possible. */
+  for (size_t i = 0; i < code_size; ++i) {
+    size_t best_length = 1;
+    for (size_t s = 0; s < superinstrs_count; ++s) {
+      const superinstr_t* superinstr = &superinstrs[s];
+      /* Calls must go through the counting handlers of the JIT */
+      if (jit_enabled && superinstr_calls(superinstr))
+        continue;
+      /* Calls and returns must poll for samples */
+      if (sample_file_name != NULL
+          && (superinstr_calls(superinstr) || superinstr_returns(superinstr)))
+        continue;
+      /* Allocations must go through the recording handlers of the heap
+         profiler */
+      if (heap_profiler_is_running() && superinstr_allocates(superinstr))
+        continue;
+      if (superinstr->length > best_length
+          && superinstr_matches(superinstr, &raw_code[i], code_size - i)) {
+        code[i].handler = superinstr->handler;
+        best_length = superinstr->length;
+      }
+    }
+  }
 }
 
-static int instr_extract_s(instr_t instr, int start, int len) {
-  int bits = (int)instr_extract_u(instr, start, len);
-  int m = 1 << (len - 1);
-  return (bits ^ m) - m;
+// Code address <-> decoded instruction translation
+
+static decoded_instr_t* code_v_to_p(uvalue_t v_addr) {
+  assert(v_addr % sizeof(instr_t) == 0);
+  assert(v_addr / sizeof(instr_t) < code_size);
+  return code + v_addr / sizeof(instr_t);
 }
 
-static opcode_t instr_opcode(instr_t instr) {
-  unsigned int opcode = instr_extract_u(instr, 26, 6);
-  return (opcode_t)opcode;
+static uvalue_t code_p_to_v(decoded_instr_t* p_addr) {
+  assert(code <= p_addr);
+  return (uvalue_t)((size_t)(p_addr - code) * sizeof(instr_t));
 }
 
-static reg_id_t instr_ra(instr_t instr) {
-  return (reg_id_t)instr_extract_u(instr, 18, 8);
+// JIT compilation
+
+static void jit_prepare(void) {
+  jit_setup(raw_code, code_size);
+  jit_call_counts = calloc(code_size, sizeof(uint32_t));
+  jit_entries = calloc(code_size, sizeof(jit_code_t));
+  if (code_size > 0 && (jit_call_counts == NULL || jit_entries == NULL))
+    fail("cannot allocate memory for JIT compiler");
 }
 
-static reg_id_t instr_rb(instr_t instr) {
-  return (reg_id_t)instr_extract_u(instr, 10, 8);
+/* Compile the function starting at the given instruction, and make the
+   interpreter enter native code whenever possible. */
+static void jit_install(size_t entry, void* labels[]) {
+  bool* in_function = calloc(code_size, sizeof(bool));
+  if (in_function == NULL)
+    fail("cannot allocate memory for JIT compiler");
+
+  if (jit_compile_function(entry, in_function, jit_entries)) {
+    for (size_t i = 0; i < code_size; ++i) {
+      if (!in_function[i])
+        continue;
+      code[i].handler = jit_entries[i] != NULL
+        ? jit_enter_label
+        : labels[instr_opcode(raw_code[i])];
+    }
+  }
+  free(in_function);
+}
+
+// Sampling profiler
+
+/* Maximum number of frames recorded per sample */
+#define SAMPLE_MAX_DEPTH 1024
+
+static bool sampling = false;
+static volatile sig_atomic_t sample_requested = 0;
+
+void engine_set_sample_file(char* file_name) {
+  sample_file_name = file_name;
 }
 
-static reg_id_t instr_rc(instr_t instr) {
-  return (reg_id_t)instr_extract_u(instr, 2, 8);
+/* Make the next call or return take a sample. Called from a signal
+   handler, so it only sets a flag, polled by the handlers of TCAL, CALL
+   and RET. */
+static void sample_request(void) {
+  sample_requested = 1;
 }
 
-static int instr_d(instr_t instr) {
-  return instr_extract_s(instr, 0, 10);
+static void sample_setup(void) {
+  sampling = true;
+  sample_requested = 0;
+  sampler_start(sample_request);
 }
 
+static void sample_cleanup(void) {
+  if (!sampling)
+    return;
+  sampler_stop();
+  sampler_write(sample_file_name);
+  sampling = false;
+}
+
+/* Record the current code address and the return addresses of the
+   active frames, found by following the caller's Ib saved in I0 of
+   every frame up to the main program. */
+static void sample_take(decoded_instr_t* pc) {
+  sample_requested = 0;
+
+  uvalue_t addresses[SAMPLE_MAX_DEPTH];
+  size_t depth = 0;
+  addresses[depth++] = code_p_to_v(pc);
+  uvalue_t* frame = R[Ib];
+  while (frame != memory_start && depth < SAMPLE_MAX_DEPTH) {
+    addresses[depth++] = frame[3];
+    frame = addr_v_to_p(frame[0]);
+  }
+  sampler_record(addresses, depth, frame != memory_start);
+}
+
+// Heap profiler
+
+/* Record the site of the block allocated by the BALO instruction at
+   the given address, which is in its register a */
+static void heap_profile_block(decoded_instr_t* site) {
+  uvalue_t* block = addr_v_to_p(R[site->ra_bank][site->ra_index]);
+  heap_profiler_record(block, code_p_to_v(site));
+}
+
+/* Record the site of the frame allocated by the RALO instruction at the
+   given address, unless it is on the register-frame stack */
+static void heap_profile_frame(decoded_instr_t* site) {
+  uvalue_t* frame = NULL;
+  switch (site->ra_bank) {
+  case 0: frame = R[Lb]; break;
+  case 1: frame = R[Ib]; break;
+  case 2: frame = R[Ob]; break;
+  }
+  if (frame != NULL && !is_stack_frame(frame))
+    heap_profiler_record(frame, code_p_to_v(site));
+}
+
+#ifdef ENGINE_PROFILE
+
+// Execution profile
+
+/* Counts of executed opcodes, and of pairs of opcodes executed one
+   after the other (whether the first one jumped or not). */
+static uint64_t opcode_count[OPCODE_COUNT];
+static uint64_t pair_count[OPCODE_COUNT][OPCODE_COUNT];
+
+/* Counts of executed straight-line opcode sequences of length 2 and
+   3, i.e. sequences where all but the last instruction fall through
+   to the next one. They are used to select superinstructions. */
+static uint64_t ngram2_count[OPCODE_COUNT][OPCODE_COUNT];
+static uint64_t ngram3_count[OPCODE_COUNT][OPCODE_COUNT][OPCODE_COUNT];
+
+/* Counts of executions per instruction, and of taken and not taken
+   conditional jumps per instruction. */
+static uint64_t* pc_count;
+static uint64_t* taken_count;
+static uint64_t* not_taken_count;
+
+static char* profile_file_name;
+
+static const char* opcode_names[OPCODE_COUNT] = {
+  "ADD", "SUB", "MUL", "DIV", "MOD",
+  "LSL", "LSR", "AND", "OR", "XOR",
+  "JLT", "JLE", "JEQ", "JNE", "JI",
+  "TCAL", "CALL", "RET", "HALT",
+  "LDLO", "LDHI", "MOVE",
+  "RALO", "BALO", "BSIZ", "BTAG", "BGET", "BSET",
+  "BREA", "BWRI", "BLKR", "BLKW",
+  "ADDI", "SUBI", "LSLI", "LSRI", "ANDI", "ORI",
+  "JLTI", "JLEI", "JGTI", "JGEI", "JEQI", "JNEI",
+};
+
+void engine_set_profile_file(char* file_name) {
+  profile_file_name = file_name;
+}
+
+static void profile_setup(void) {
+  pc_count = calloc(code_size, sizeof(uint64_t));
+  taken_count = calloc(code_size, sizeof(uint64_t));
+  not_taken_count = calloc(code_size, sizeof(uint64_t));
+  if (code_size > 0
+      && (pc_count == NULL || taken_count == NULL || not_taken_count == NULL))
+    fail("cannot allocate memory for profile");
+}
+
+static void profile_cleanup(void) {
+  free(not_taken_count);
+  free(taken_count);
+  free(pc_count);
+  pc_count = taken_count = not_taken_count = NULL;
+}
+
+static bool opcode_is_cond_jump(opcode_t opcode) {
+  switch (opcode) {
+  case opcode_JLT: case opcode_JLE: case opcode_JEQ: case opcode_JNE:
+  case opcode_JLTI: case opcode_JLEI: case opcode_JGTI: case opcode_JGEI:
+  case opcode_JEQI: case opcode_JNEI:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool opcode_falls_through(opcode_t opcode) {
+  switch (opcode) {
+  case opcode_JLT: case opcode_JLE: case opcode_JEQ: case opcode_JNE:
+  case opcode_JLTI: case opcode_JLEI: case opcode_JGTI: case opcode_JGEI:
+  case opcode_JEQI: case opcode_JNEI:
+  case opcode_JI: case opcode_TCAL: case opcode_CALL: case opcode_RET:
+  case opcode_HALT:
+    return false;
+  default:
+    return true;
+  }
+}
+
+static void profile_instr(decoded_instr_t* pc) {
+  static decoded_instr_t* prev_pc[2];
+  static opcode_t prev_opcode[2];
+
+  size_t index = (size_t)(pc - code);
+  opcode_t opcode = instr_opcode(raw_code[index]);
+
+  opcode_count[opcode] += 1;
+  pc_count[index] += 1;
+  if (prev_pc[0] != NULL) {
+    size_t prev_index = (size_t)(prev_pc[0] - code);
+    pair_count[prev_opcode[0]][opcode] += 1;
+    if (opcode_is_cond_jump(prev_opcode[0])) {
+      /* The offset is taken from the original instruction. A jump to
+         the next instruction cannot be told apart from a fall-through,
+         so it is counted as not taken. */
+      int offset = instr_d(raw_code[prev_index]);
+      if (offset != 1 && pc == prev_pc[0] + offset)
+        taken_count[prev_index] += 1;
+      else
+        not_taken_count[prev_index] += 1;
+    }
+  }
+
+  bool seq2 = prev_pc[0] == pc - 1 && opcode_falls_through(prev_opcode[0]);
+  if (seq2)
+    ngram2_count[prev_opcode[0]][opcode] += 1;
+  if (seq2 && prev_pc[1] == pc - 2 && opcode_falls_through(prev_opcode[1]))
+    ngram3_count[prev_opcode[1]][prev_opcode[0]][opcode] += 1;
+
+  prev_pc[1] = prev_pc[0];
+  prev_opcode[1] = prev_opcode[0];
+  prev_pc[0] = pc;
+  prev_opcode[0] = opcode;
+}
+
+static void profile_write(void) {
+  if (profile_file_name == NULL)
+    return;
+
+  FILE* file = fopen(profile_file_name, "w");
+  if (file == NULL)
+    fail("cannot open profile file %s", profile_file_name);
+
+  fprintf(file, "kind,key,count\n");
+  for (opcode_t o1 = 0; o1 < OPCODE_COUNT; ++o1) {
+    if (opcode_count[o1] > 0)
+      fprintf(file, "opcode,%s,%llu\n",
+              opcode_names[o1], (unsigned long long)opcode_count[o1]);
+  }
+  for (opcode_t o1 = 0; o1 < OPCODE_COUNT; ++o1) {
+    for (opcode_t o2 = 0; o2 < OPCODE_COUNT; ++o2) {
+      if (pair_count[o1][o2] > 0)
+        fprintf(file, "pair,%s %s,%llu\n",
+                opcode_names[o1], opcode_names[o2],
+                (unsigned long long)pair_count[o1][o2]);
+    }
+  }
+  for (opcode_t o1 = 0; o1 < OPCODE_COUNT; ++o1) {
+    for (opcode_t o2 = 0; o2 < OPCODE_COUNT; ++o2) {
+      if (ngram2_count[o1][o2] > 0)
+        fprintf(file, "ngram,%s %s,%llu\n",
+                opcode_names[o1], opcode_names[o2],
+                (unsigned long long)ngram2_count[o1][o2]);
+      for (opcode_t o3 = 0; o3 < OPCODE_COUNT; ++o3) {
+        if (ngram3_count[o1][o2][o3] > 0)
+          fprintf(file, "ngram,%s %s %s,%llu\n",
+                  opcode_names[o1], opcode_names[o2], opcode_names[o3],
+                  (unsigned long long)ngram3_count[o1][o2][o3]);
+      }
+    }
+  }
+  /* Instructions are identified by their (virtual) code address */
+  for (size_t i = 0; i < code_size; ++i) {
+    uvalue_t addr = (uvalue_t)(i * sizeof(instr_t));
+    if (pc_count[i] > 0)
+      fprintf(file, "pc,%u,%llu\n", addr, (unsigned long long)pc_count[i]);
+    if (taken_count[i] > 0)
+      fprintf(file, "taken,%u,%llu\n",
+              addr, (unsigned long long)taken_count[i]);
+    if (not_taken_count[i] > 0)
+      fprintf(file, "not-taken,%u,%llu\n",
+              addr, (unsigned long long)not_taken_count[i]);
+  }
+
+  fclose(file);
+}
+
+#endif // ENGINE_PROFILE
+
 // (Pseudo-)register access
 
-#define Ra (R[reg_bank(instr_ra(*pc))][reg_index(instr_ra(*pc))])
-#define Rb (R[reg_bank(instr_rb(*pc))][reg_index(instr_rb(*pc))])
-#define Rc (R[reg_bank(instr_rc(*pc))][reg_index(instr_rc(*pc))])
+#define Ra (R[pc->ra_bank][pc->ra_index])
+#define Rb (R[pc->rb_bank][pc->rb_index])
+#define Rc (R[pc->rc_bank][pc->rc_index])
+
+#ifdef ENGINE_PROFILE
+#define GOTO_NEXT { profile_instr(pc); goto *pc->handler; }
+#else
+#define GOTO_NEXT goto *pc->handler
+#endif
 
-#define GOTO_NEXT goto *labels[instr_opcode(*pc)]
+// Instruction semantics, shared by simple and superinstruction handlers
+
+#define JIT_COUNT_CALL {                                        \
+    size_t target = Ra / sizeof(instr_t);                       \
+    if (jit_call_counts[target] < JIT_HOT_THRESHOLD             \
+        && ++jit_call_counts[target] == JIT_HOT_THRESHOLD)      \
+      jit_install(target, labels);                              \
+  }
+
+#define SAMPLE_POLL {                                           \
+    if (sample_requested)                                       \
+      sample_take(pc);                                          \
+  }
+
+#define EXEC_ADD {                                              \
+    Ra = Rb + Rc;                                               \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_SUB {                                              \
+    Ra = Rb - Rc;                                               \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_MUL {                                              \
+    Ra = Rb * Rc;                                               \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_DIV {                                              \
+    Ra = (uvalue_t)((value_t)Rb / (value_t)Rc);                 \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_MOD {                                              \
+    Ra = (uvalue_t)((value_t)Rb % (value_t)Rc);                 \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_LSL {                                              \
+    Ra = Rb << (Rc & 0x1F);                                     \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_LSR {                                              \
+    Ra = Rb >> (Rc & 0x1F);                                     \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_AND {                                              \
+    Ra = Rb & Rc;                                               \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_OR {                                               \
+    Ra = Rb | Rc;                                               \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_XOR {                                              \
+    Ra = Rb ^ Rc;                                               \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_ADDI {                                             \
+    Ra = Rb + (uvalue_t)pc->imm;                                \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_SUBI {                                             \
+    Ra = Rb - (uvalue_t)pc->imm;                                \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_LSLI {                                             \
+    Ra = Rb << (pc->imm & 0x1F);                                \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_LSRI {                                             \
+    Ra = Rb >> (pc->imm & 0x1F);                                \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_ANDI {                                             \
+    Ra = Rb & (uvalue_t)pc->imm;                                \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_ORI {                                              \
+    Ra = Rb | (uvalue_t)pc->imm;                                \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_JLT {                                              \
+    pc += ((value_t)Ra < (value_t)Rb ? pc->imm : 1);            \
+  }
+
+#define EXEC_JLE {                                              \
+    pc += ((value_t)Ra <= (value_t)Rb ? pc->imm : 1);           \
+  }
+
+#define EXEC_JEQ {                                              \
+    pc += (Ra == Rb ? pc->imm : 1);                             \
+  }
+
+#define EXEC_JNE {                                              \
+    pc += (Ra != Rb ? pc->imm : 1);                             \
+  }
+
+#define EXEC_JLTI {                                             \
+    pc += ((value_t)Ra < pc->jump_imm ? pc->imm : 1);           \
+  }
+
+#define EXEC_JLEI {                                             \
+    pc += ((value_t)Ra <= pc->jump_imm ? pc->imm : 1);          \
+  }
+
+#define EXEC_JGTI {                                             \
+    pc += ((value_t)Ra > pc->jump_imm ? pc->imm : 1);           \
+  }
+
+#define EXEC_JGEI {                                             \
+    pc += ((value_t)Ra >= pc->jump_imm ? pc->imm : 1);          \
+  }
+
+#define EXEC_JEQI {                                             \
+    pc += ((value_t)Ra == pc->jump_imm ? pc->imm : 1);          \
+  }
+
+#define EXEC_JNEI {                                             \
+    pc += ((value_t)Ra != pc->jump_imm ? pc->imm : 1);          \
+  }
+
+#define EXEC_JI {                                               \
+    pc += pc->imm;                                              \
+  }
+
+#define EXEC_TCAL {                                             \
+    decoded_instr_t* target_pc = code_v_to_p(Ra);               \
+    R[Ob][0] = R[Ib][0];                                        \
+    R[Ob][1] = R[Ib][1];                                        \
+    R[Ob][2] = R[Ib][2];                                        \
+    R[Ob][3] = R[Ib][3];                                        \
+    engine_set_Ib(frames_pop_tail_call(R[Ib], R[Ob]));          \
+    engine_set_Lb(memory_start);                                \
+    engine_set_Ob(memory_start);                                \
+    pc = target_pc;                                             \
+  }
+
+#define EXEC_CALL {                                             \
+    decoded_instr_t* target_pc = code_v_to_p(Ra);               \
+    R[Ob][0] = addr_p_to_v(R[Ib]);                              \
+    R[Ob][1] = addr_p_to_v(R[Lb]);                              \
+    R[Ob][2] = addr_p_to_v(R[Ob]);                              \
+    R[Ob][3] = code_p_to_v(pc + 1);                             \
+    engine_set_Ib(R[Ob]);                                       \
+    engine_set_Lb(memory_start);                                \
+    engine_set_Ob(memory_start);                                \
+    pc = target_pc;                                             \
+  }
+
+#define EXEC_RET {                                              \
+    uvalue_t ret_value = R[Ib][4];                              \
+    decoded_instr_t* target_pc = code_v_to_p(R[Ib][3]);         \
+    frames_pop_return(R[Ib]);                                   \
+    engine_set_Ob(addr_v_to_p(R[Ib][2]));                       \
+    engine_set_Lb(addr_v_to_p(R[Ib][1]));                       \
+    engine_set_Ib(addr_v_to_p(R[Ob][0]));                       \
+    R[Ob][0] = ret_value;                                       \
+    pc = target_pc;                                             \
+  }
+
+#ifdef ENGINE_PROFILE
+#define EXEC_HALT {                                             \
+    profile_write();                                            \
+    io_flush();                                                 \
+    return Ra;                                                  \
+  }
+#else
+#define EXEC_HALT {                                             \
+    io_flush();                                                 \
+    return Ra;                                                  \
+  }
+#endif
+
+#define EXEC_LDLO {                                             \
+    Ra = (uvalue_t)pc->imm;                                     \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_LDHI {                                             \
+    Ra = (uvalue_t)pc->imm | (Ra & 0xFFFF);                     \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_MOVE {                                             \
+    Ra = Rb;                                                    \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_RALO {                                             \
+    uvalue_t size = (uvalue_t)pc->imm;                          \
+    uvalue_t* block = frame_allocate(size);                     \
+    switch (pc->ra_bank) {                                      \
+    case 0: engine_set_Lb(block); break;                        \
+    case 1: engine_set_Ib(block); break;                        \
+    case 2: engine_set_Ob(block); break;                        \
+    }                                                           \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_BALO {                                             \
+    uvalue_t* block =                                           \
+      memory_buffer_allocate(alloc_buffer, (tag_t)pc->imm, Rb); \
+    Ra = addr_p_to_v(block);                                    \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_BSIZ {                                             \
+    Ra = memory_get_block_size(addr_v_to_p(Rb));                \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_BTAG {                                             \
+    Ra = memory_get_block_tag(addr_v_to_p(Rb));                 \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_BGET {                                             \
+    uvalue_t* block = addr_v_to_p(Rb);                          \
+    uvalue_t index = Rc;                                        \
+    assert(index < memory_get_block_size(block));              \
+    Ra = block[index];                                          \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_BSET {                                             \
+    uvalue_t* block = addr_v_to_p(Rb);                          \
+    uvalue_t index = Rc;                                        \
+    assert(index < memory_get_block_size(block));              \
+    memory_mark_card(card_table,                                \
+                     Rb + index * (uvalue_t)sizeof(uvalue_t));  \
+    block[index] = Ra;                                          \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_BREA {                                             \
+    Ra = (uvalue_t)io_read_byte();                              \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_BWRI {                                             \
+    io_write_byte((uint8_t)Ra);                                 \
+    pc += 1;                                                    \
+  }
+
+/* The elements of the blocks read and written by BLKR and BLKW are
+   bytes, represented as tagged L3 integers, and so is the number of
+   bytes read by BLKR. */
+#define EXEC_BLKR {                                             \
+    uvalue_t* block = addr_v_to_p(Rb);                          \
+    uvalue_t count =                                            \
+      io_read_block(block, memory_get_block_size(block));       \
+    Ra = (count << 1) | 1;                                      \
+    pc += 1;                                                    \
+  }
+
+#define EXEC_BLKW {                                             \
+    uvalue_t* block = addr_v_to_p(Ra);                          \
+    io_write_block(block, memory_get_block_size(block));        \
+    pc += 1;                                                    \
+  }
 
 uvalue_t engine_run() {
-  instr_t* pc = memory_start;
   engine_set_Lb(memory_start);
   engine_set_Ib(memory_start);
   engine_set_Ob(memory_start);
 
-  void** labels[OPCODE_COUNT];
+  void* labels[OPCODE_COUNT];
   labels[opcode_ADD] = &&l_ADD;
   labels[opcode_SUB] = &&l_SUB;
   labels[opcode_MUL] = &&l_MUL;
@@ -141,185 +1094,141 @@ uvalue_t engine_run() {
   labels[opcode_BSET] = &&l_BSET;
   labels[opcode_BREA] = &&l_BREA;
   labels[opcode_BWRI] = &&l_BWRI;
+  labels[opcode_BLKR] = &&l_BLKR;
+  labels[opcode_BLKW] = &&l_BLKW;
+  labels[opcode_ADDI] = &&l_ADDI;
+  labels[opcode_SUBI] = &&l_SUBI;
+  labels[opcode_LSLI] = &&l_LSLI;
+  labels[opcode_LSRI] = &&l_LSRI;
+  labels[opcode_ANDI] = &&l_ANDI;
+  labels[opcode_ORI] = &&l_ORI;
+  labels[opcode_JLTI] = &&l_JLTI;
+  labels[opcode_JLEI] = &&l_JLEI;
+  labels[opcode_JGTI] = &&l_JGTI;
+  labels[opcode_JGEI] = &&l_JGEI;
+  labels[opcode_JEQI] = &&l_JEQI;
+  labels[opcode_JNEI] = &&l_JNEI;
 
-  GOTO_NEXT;
-
- l_ADD: {
-    Ra = Rb + Rc;
-    pc += 1;
-  } GOTO_NEXT;
-
- l_SUB: {
-    Ra = Rb - Rc;
-    pc += 1;
-  } GOTO_NEXT;
-
- l_MUL: {
-    Ra = Rb * Rc;
-    pc += 1;
-  } GOTO_NEXT;
-
- l_DIV: {
-    Ra = (uvalue_t)((value_t)Rb / (value_t)Rc);
-    pc += 1;
-  } GOTO_NEXT;
-
- l_MOD: {
-    Ra = (uvalue_t)((value_t)Rb % (value_t)Rc);
-    pc += 1;
-  } GOTO_NEXT;
-
- l_LSL: {
-    Ra = Rb << (Rc & 0x1F);
-    pc += 1;
-  } GOTO_NEXT;
-
- l_LSR: {
-    Ra = Rb >> (Rc & 0x1F);
-    pc += 1;
-  } GOTO_NEXT;
-
- l_AND: {
-    Ra = Rb & Rc;
-    pc += 1;
-  } GOTO_NEXT;
-
- l_OR: {
-    Ra = Rb | Rc;
-    pc += 1;
-  } GOTO_NEXT;
-
- l_XOR: {
-    Ra = Rb ^ Rc;
-    pc += 1;
-  } GOTO_NEXT;
-
- l_JLT: {
-    pc += ((value_t)Ra < (value_t)Rb ? instr_d(*pc) : 1);
-  } GOTO_NEXT;
-
- l_JLE: {
-    pc += ((value_t)Ra <= (value_t)Rb ? instr_d(*pc) : 1);
-  } GOTO_NEXT;
-
- l_JEQ: {
-    pc += (Ra == Rb ? instr_d(*pc) : 1);
-  } GOTO_NEXT;
-
- l_JNE: {
-    pc += (Ra != Rb ? instr_d(*pc) : 1);
-  } GOTO_NEXT;
-
- l_JI: {
-    pc += instr_extract_s(*pc, 0, 26);
-  } GOTO_NEXT;
-
- l_TCAL: {
-    instr_t* target_pc = addr_v_to_p(Ra);
-    R[Ob][0] = R[Ib][0];
-    R[Ob][1] = R[Ib][1];
-    R[Ob][2] = R[Ib][2];
-    R[Ob][3] = R[Ib][3];
-    engine_set_Ib(R[Ob]);
-    engine_set_Lb(memory_start);
-    engine_set_Ob(memory_start);
-    pc = target_pc;
-  } GOTO_NEXT;
-
- l_CALL: {
-    instr_t* target_pc = addr_v_to_p(Ra);
-    R[Ob][0] = addr_p_to_v(R[Ib]);
-    R[Ob][1] = addr_p_to_v(R[Lb]);
-    R[Ob][2] = addr_p_to_v(R[Ob]);
-    R[Ob][3] = addr_p_to_v(pc + 1);
-    engine_set_Ib(R[Ob]);
-    engine_set_Lb(memory_start);
-    engine_set_Ob(memory_start);
-    pc = target_pc;
-  } GOTO_NEXT;
-
- l_RET: {
-    uvalue_t ret_value = R[Ib][4];
-    instr_t* target_pc = addr_v_to_p(R[Ib][3]);
-    engine_set_Ob(addr_v_to_p(R[Ib][2]));
-    engine_set_Lb(addr_v_to_p(R[Ib][1]));
-    engine_set_Ib(addr_v_to_p(R[Ob][0]));
-    R[Ob][0] = ret_value;
-    pc = target_pc;
-  } GOTO_NEXT;
-
- l_HALT: {
-    return Ra;
+  if (sample_file_name != NULL) {
+    labels[opcode_TCAL] = &&l_TCAL_SAMPLE;
+    labels[opcode_CALL] = &&l_CALL_SAMPLE;
+    labels[opcode_RET] = &&l_RET_SAMPLE;
+  }
+  /* The counting handlers also poll for samples */
+  if (jit_enabled) {
+    // Stored rather than passed to jit_install, which may then be
+    // compiled apart from this function
+    jit_enter_label = &&l_JIT_ENTER;
+    labels[opcode_TCAL] = &&l_TCAL_COUNT;
+    labels[opcode_CALL] = &&l_CALL_COUNT;
+  }
+  if (heap_profiler_is_running()) {
+    labels[opcode_RALO] = &&l_RALO_PROFILE;
+    labels[opcode_BALO] = &&l_BALO_PROFILE;
   }
 
- l_LDLO: {
-    Ra = (uvalue_t)instr_extract_s(*pc, 0, 18);
-    pc += 1;
-  } GOTO_NEXT;
-
- l_LDHI: {
-    Ra = ((uvalue_t)instr_extract_u(*pc, 0, 16) << 16) | (Ra & 0xFFFF);
-    pc += 1;
-  } GOTO_NEXT;
-
- l_MOVE: {
-    Ra = Rb;
-    pc += 1;
-  } GOTO_NEXT;
+#ifdef ENGINE_PROFILE
+  /* Superinstructions are disabled when profiling, as they would hide
+     the sequences they fuse. */
+  decode_code(labels, NULL, 0);
+  profile_setup();
+#else
+#define SUPERINSTRUCTION2(o1, o2)                                       \
+  { { opcode_##o1, opcode_##o2 }, 2, &&l_##o1##_##o2 },
+#define SUPERINSTRUCTION3(o1, o2, o3)                                   \
+  { { opcode_##o1, opcode_##o2, opcode_##o3 }, 3, &&l_##o1##_##o2##_##o3 },
+  const superinstr_t superinstrs[] = {
+#include "superinstructions.h"
+    { { opcode_HALT }, 0, NULL }  /* sentinel, never matches */
+  };
+#undef SUPERINSTRUCTION2
+#undef SUPERINSTRUCTION3
+  decode_code(labels,
+              superinstrs,
+              sizeof(superinstrs) / sizeof(superinstrs[0]));
+#endif
 
- l_RALO: {
-    uvalue_t size = instr_extract_u(*pc, 16, 8);
-    uvalue_t* block = memory_allocate(tag_RegisterFrame, size);
-    switch (instr_extract_u(*pc, 24, 2)) {
-    case 0: engine_set_Lb(block); break;
-    case 1: engine_set_Ib(block); break;
-    case 2: engine_set_Ob(block); break;
-    }
-    pc += 1;
-  } GOTO_NEXT;
+  if (jit_enabled)
+    jit_prepare();
+  if (sample_file_name != NULL)
+    sample_setup();
 
- l_BALO: {
-    uvalue_t* block = memory_allocate(instr_extract_u(*pc, 2, 8), Rb);
-    Ra = addr_p_to_v(block);
-    pc += 1;
-  } GOTO_NEXT;
+  decoded_instr_t* pc = code;
 
- l_BSIZ: {
-    Ra = memory_get_block_size(addr_v_to_p(Rb));
-    pc += 1;
-  } GOTO_NEXT;
+  GOTO_NEXT;
 
- l_BTAG: {
-    Ra = memory_get_block_tag(addr_v_to_p(Rb));
-    pc += 1;
-  } GOTO_NEXT;
+ l_ADD: EXEC_ADD GOTO_NEXT;
+ l_SUB: EXEC_SUB GOTO_NEXT;
+ l_MUL: EXEC_MUL GOTO_NEXT;
+ l_DIV: EXEC_DIV GOTO_NEXT;
+ l_MOD: EXEC_MOD GOTO_NEXT;
+ l_LSL: EXEC_LSL GOTO_NEXT;
+ l_LSR: EXEC_LSR GOTO_NEXT;
+ l_AND: EXEC_AND GOTO_NEXT;
+ l_OR: EXEC_OR GOTO_NEXT;
+ l_XOR: EXEC_XOR GOTO_NEXT;
+ l_JLT: EXEC_JLT GOTO_NEXT;
+ l_JLE: EXEC_JLE GOTO_NEXT;
+ l_JEQ: EXEC_JEQ GOTO_NEXT;
+ l_JNE: EXEC_JNE GOTO_NEXT;
+ l_JI: EXEC_JI GOTO_NEXT;
+ l_TCAL: EXEC_TCAL GOTO_NEXT;
+ l_CALL: EXEC_CALL GOTO_NEXT;
+ l_RET: EXEC_RET GOTO_NEXT;
+ l_HALT: EXEC_HALT
+ l_LDLO: EXEC_LDLO GOTO_NEXT;
+ l_LDHI: EXEC_LDHI GOTO_NEXT;
+ l_MOVE: EXEC_MOVE GOTO_NEXT;
+ l_RALO: EXEC_RALO GOTO_NEXT;
+ l_BALO: EXEC_BALO GOTO_NEXT;
+ l_BSIZ: EXEC_BSIZ GOTO_NEXT;
+ l_BTAG: EXEC_BTAG GOTO_NEXT;
+ l_BGET: EXEC_BGET GOTO_NEXT;
+ l_BSET: EXEC_BSET GOTO_NEXT;
+ l_BREA: EXEC_BREA GOTO_NEXT;
+ l_BWRI: EXEC_BWRI GOTO_NEXT;
+ l_BLKR: EXEC_BLKR GOTO_NEXT;
+ l_BLKW: EXEC_BLKW GOTO_NEXT;
+ l_ADDI: EXEC_ADDI GOTO_NEXT;
+ l_SUBI: EXEC_SUBI GOTO_NEXT;
+ l_LSLI: EXEC_LSLI GOTO_NEXT;
+ l_LSRI: EXEC_LSRI GOTO_NEXT;
+ l_ANDI: EXEC_ANDI GOTO_NEXT;
+ l_ORI: EXEC_ORI GOTO_NEXT;
+ l_JLTI: EXEC_JLTI GOTO_NEXT;
+ l_JLEI: EXEC_JLEI GOTO_NEXT;
+ l_JGTI: EXEC_JGTI GOTO_NEXT;
+ l_JGEI: EXEC_JGEI GOTO_NEXT;
+ l_JEQI: EXEC_JEQI GOTO_NEXT;
+ l_JNEI: EXEC_JNEI GOTO_NEXT;
 
- l_BGET: {
-    uvalue_t* block = addr_v_to_p(Rb);
-    uvalue_t index = Rc;
-    assert(index < memory_get_block_size(block));
-    Ra = block[index];
-    pc += 1;
+ l_TCAL_COUNT: SAMPLE_POLL JIT_COUNT_CALL EXEC_TCAL GOTO_NEXT;
+ l_CALL_COUNT: SAMPLE_POLL JIT_COUNT_CALL EXEC_CALL GOTO_NEXT;
+ l_JIT_ENTER: {
+    jit_code_t native_code = jit_entries[pc - code];
+    pc = code + native_code(R, memory_start);
   } GOTO_NEXT;
-
- l_BSET: {
-    uvalue_t* block = addr_v_to_p(Rb);
-  uvalue_t index = Rc;
-    assert(index < memory_get_block_size(block));
-    block[index] = Ra;
-    pc += 1;
+ l_RALO_PROFILE: {
+    decoded_instr_t* site = pc;
+    EXEC_RALO
+    heap_profile_frame(site);
   } GOTO_NEXT;
-
- l_BREA: {
-    uint8_t byte;
-    size_t read = fread(&byte, sizeof(byte), 1, stdin);
-    Ra = (uvalue_t)(read == sizeof(byte) ? byte : -1);
-    pc += 1;
+ l_BALO_PROFILE: {
+    decoded_instr_t* site = pc;
+    EXEC_BALO
+    heap_profile_block(site);
   } GOTO_NEXT;
+ l_TCAL_SAMPLE: SAMPLE_POLL EXEC_TCAL GOTO_NEXT;
+ l_CALL_SAMPLE: SAMPLE_POLL EXEC_CALL GOTO_NEXT;
+ l_RET_SAMPLE: SAMPLE_POLL EXEC_RET GOTO_NEXT;
 
- l_BWRI: {
-    uint8_t byte = (uint8_t)Ra;
-    fwrite(&byte, sizeof(byte), 1, stdout);
-    pc += 1;
-  } GOTO_NEXT;
+#ifndef ENGINE_PROFILE
+#define SUPERINSTRUCTION2(o1, o2)                                       \
+  l_##o1##_##o2: EXEC_##o1 EXEC_##o2 GOTO_NEXT;
+#define SUPERINSTRUCTION3(o1, o2, o3)                                   \
+  l_##o1##_##o2##_##o3: EXEC_##o1 EXEC_##o2 EXEC_##o3 GOTO_NEXT;
+#include "superinstructions.h"
+#undef SUPERINSTRUCTION2
+#undef SUPERINSTRUCTION3
+#endif
 }
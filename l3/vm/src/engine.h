@@ -1,6 +1,8 @@
 #ifndef ENGINE__H
 #define ENGINE__H
 
+#include <stddef.h>
+#include <stdbool.h>
 #include "vmtypes.h"
 
 /* Setup the interpreter */
@@ -12,6 +14,38 @@ void engine_cleanup(void);
 /* Add an instruction to the code area of the memory */
 void engine_emit(instr_t instr, instr_t** instr_ptr);
 
+/* Use the given code in place, instead of code emitted to the memory.
+   It must remain valid until engine_cleanup. Its addresses are
+   reserved at the start of the memory. Return the end of the reserved
+   area. */
+void* engine_use_code(const instr_t* instrs, size_t size);
+
+/* Reserve the register-frame stack, of the given size in bytes, at
+   the given address. Return the end of the reserved area. */
+void* engine_setup_frames(void* start, size_t byte_size);
+
+/* Return the bounds of the used part of the register-frame stack,
+   whose frames are roots for the garbage collector */
+uvalue_t* engine_get_frames_start(void);
+uvalue_t* engine_get_frames_top(void);
+
+/* Load the liveness maps written by the compiler next to the program,
+   which give the registers live after each call. Must be called once
+   the code is loaded. Return false if the file cannot be opened, or if
+   its checksum does not match the code, in which case it is ignored. */
+bool engine_load_liveness(char* file_name);
+
+/* Return true if liveness maps were loaded */
+bool engine_has_liveness(void);
+
+/* Call f on the registers of the active frames which may hold pointers:
+   all the registers of the frames of the current function, but only the
+   ones live after their call, according to the liveness maps, for the
+   frames of its callers. Frames allocated in the heap are reached
+   through the registers that link each function to its caller, and
+   their other registers must not be scanned. */
+void engine_for_each_live_register(void (*f)(uvalue_t* reg));
+
 /* Return the heap address of the register bank */
 uvalue_t* engine_get_Lb(void);
 uvalue_t* engine_get_Ib(void);
@@ -22,7 +56,19 @@ void engine_set_Lb(uvalue_t* new_value);
 void engine_set_Ib(uvalue_t* new_value);
 void engine_set_Ob(uvalue_t* new_value);
 
+/* Compile hot functions to native code (must precede engine_run) */
+void engine_enable_jit(void);
+
+/* Sample the call stack periodically, and write the samples as folded
+   stacks to the given file on cleanup (must precede engine_run) */
+void engine_set_sample_file(char* file_name);
+
 /* Interpret the program in the code area of the memory */
 uvalue_t engine_run(void);
 
+#ifdef ENGINE_PROFILE
+/* Set the file to which the execution profile is written on HALT */
+void engine_set_profile_file(char* file_name);
+#endif
+
 #endif // ENGINE__H
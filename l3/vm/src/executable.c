@@ -0,0 +1,132 @@
+#define _DEFAULT_SOURCE /* for fstat and mmap */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "executable.h"
+#include "fail.h"
+
+#define EXECUTABLE_MAGIC 0x1A58334Cu /* "L3X\x1A", little-endian */
+#define HEADER_WORDS 8
+
+enum {
+  header_magic, header_version,
+  header_code_offset, header_code_size,
+  header_symbols_offset, header_symbols_count,
+  header_checksum, header_reserved
+};
+
+/* Checksum of the given words of a file, in which the checksum itself
+   counts as 0 */
+static uint32_t checksum(const uint32_t* words, size_t count) {
+  uint32_t hash = 2166136261u;  /* FNV-1a */
+  for (size_t i = 0; i < count; ++i) {
+    hash ^= i != header_checksum ? words[i] : 0;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* Return the number of words of the symbol at the given word index,
+   or 0 if it does not fit in the given number of words. */
+static size_t symbol_words(const uint32_t* words, size_t index, size_t end) {
+  if (end - index < 2)
+    return 0;
+  size_t name_length = words[index + 1];
+  if (name_length > (end - index - 2) * sizeof(uint32_t))
+    return 0;
+  return 2 + (name_length + 3) / sizeof(uint32_t);
+}
+
+bool executable_map(char* file_name, executable_t* executable) {
+  const uint32_t probe = 1;
+  if (*(const uint8_t*)&probe != 1)
+    fail("executable files are only supported on little-endian hosts");
+
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0)
+    fail("cannot open file %s", file_name);
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0)
+    fail("cannot read file %s", file_name);
+  size_t size = (size_t)file_stat.st_size;
+  if (size < HEADER_WORDS * sizeof(uint32_t)) {
+    close(fd);
+    return false;
+  }
+
+  /* Read-only private mappings of a file share its pages with all the
+     other mappings of the same file */
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    fail("cannot map file %s", file_name);
+
+  const uint32_t* words = mapping;
+  if (words[header_magic] != EXECUTABLE_MAGIC) {
+    munmap(mapping, size);
+    return false;
+  }
+  if (words[header_version] != EXECUTABLE_VERSION)
+    fail("unsupported version %u of executable file %s (expected %u)",
+         words[header_version], file_name, EXECUTABLE_VERSION);
+
+  size_t words_count = size / sizeof(uint32_t);
+  size_t code_offset = words[header_code_offset];
+  size_t code_size = words[header_code_size];
+  size_t symbols_offset = words[header_symbols_offset];
+  size_t symbols_count = words[header_symbols_count];
+  /* The offsets are checked against the size before any subtraction,
+     and the symbol table is checked symbol by symbol below */
+  if (size % sizeof(uint32_t) != 0
+      || code_offset % sizeof(uint32_t) != 0
+      || code_offset / sizeof(uint32_t) < HEADER_WORDS
+      || code_offset > size
+      || code_size > (size - code_offset) / sizeof(instr_t)
+      || symbols_offset % sizeof(uint32_t) != 0
+      || (symbols_offset != 0
+          && (symbols_offset / sizeof(uint32_t) < HEADER_WORDS
+              || symbols_offset > size)))
+    fail("invalid executable file %s", file_name);
+  if (checksum(words, words_count) != words[header_checksum])
+    fail("invalid checksum in executable file %s", file_name);
+
+  if (symbols_offset != 0) {
+    size_t index = symbols_offset / sizeof(uint32_t);
+    for (size_t i = 0; i < symbols_count; ++i) {
+      size_t length = symbol_words(words, index, words_count);
+      if (length == 0)
+        fail("invalid symbol table in executable file %s", file_name);
+      index += length;
+    }
+  }
+
+  executable->code = (const instr_t*)(words + code_offset / sizeof(uint32_t));
+  executable->code_size = code_size;
+  executable->symbols = symbols_offset != 0
+    ? words + symbols_offset / sizeof(uint32_t)
+    : NULL;
+  executable->symbols_count = symbols_offset != 0 ? symbols_count : 0;
+  executable->mapping = mapping;
+  executable->mapping_size = size;
+  return true;
+}
+
+void executable_for_each_symbol(const executable_t* executable,
+                                void (*f)(uvalue_t address,
+                                          const char* name,
+                                          size_t name_length)) {
+  const uint32_t* symbol = executable->symbols;
+  for (size_t i = 0; i < executable->symbols_count; ++i) {
+    f(symbol[0], (const char*)&symbol[2], symbol[1]);
+    symbol += 2 + (symbol[1] + 3) / 4;
+  }
+}
+
+void executable_unmap(executable_t* executable) {
+  munmap(executable->mapping, executable->mapping_size);
+  memset(executable, 0, sizeof(*executable));
+}
@@ -0,0 +1,55 @@
+#ifndef EXECUTABLE_H
+#define EXECUTABLE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "vmtypes.h"
+
+/* Binary executable files, written by the compiler (out.l3x). They
+ * are mapped read-only in memory and their code is used in place, so
+ * that loading them requires no parsing, and their pages are shared by
+ * all the processes running them.
+ *
+ * All fields are 32-bit little-endian words. The header is:
+ *
+ *   offset  field
+ *        0  magic number, the bytes "L3X" followed by 0x1A
+ *        4  format version (EXECUTABLE_VERSION)
+ *        8  offset of the code section, in bytes
+ *       12  size of the code section, in instructions
+ *       16  offset of the symbol table, in bytes, or 0 if absent
+ *       20  number of symbols
+ *       24  checksum of the file
+ *       28  reserved, 0
+ *
+ * Each symbol is composed of the code address of a function, the
+ * length of its name in bytes, and the name, padded with zeros to a
+ * multiple of 4 bytes. The checksum is the 32-bit FNV-1a hash of all
+ * the words of the file, header included, its own word counting as 0.
+ */
+
+#define EXECUTABLE_VERSION 2
+
+typedef struct {
+  const instr_t* code;
+  size_t code_size;             /* in instructions */
+  const uint32_t* symbols;      /* NULL if absent */
+  size_t symbols_count;
+  void* mapping;
+  size_t mapping_size;
+} executable_t;
+
+/* Map the given file. Return false if it is not an executable file
+   (e.g. an assembly file), and fail if it is an invalid one. */
+bool executable_map(char* file_name, executable_t* executable);
+
+/* Call the given function with each symbol of the executable */
+void executable_for_each_symbol(const executable_t* executable,
+                                void (*f)(uvalue_t address,
+                                          const char* name,
+                                          size_t name_length));
+
+/* Unmap the executable */
+void executable_unmap(executable_t* executable);
+
+#endif // EXECUTABLE_H
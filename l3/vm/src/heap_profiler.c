@@ -0,0 +1,186 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heap_profiler.h"
+#include "memory.h"
+#include "symbols.h"
+#include "fail.h"
+
+/* Initial number of entries of the side table (a power of 2) */
+#define HEAP_PROFILER_INITIAL_CAPACITY 4096
+
+static FILE* profile_file;
+static unsigned long collections;
+
+void heap_profiler_start(char* file_name) {
+  profile_file = fopen(file_name, "w");
+  if (profile_file == NULL)
+    fail("cannot open file %s", file_name);
+  collections = 0;
+}
+
+bool heap_profiler_is_running(void) {
+  return profile_file != NULL;
+}
+
+// Side table
+
+typedef struct {
+  uvalue_t* block;              /* NULL for free entries */
+  uvalue_t site;
+} site_entry_t;
+
+static site_entry_t* sites;     /* open-addressing hash table */
+static size_t sites_capacity;
+static size_t sites_count;
+
+static size_t hash(uint64_t key) {
+  uint64_t product = key * 0x9E3779B97F4A7C15u; /* Fibonacci hashing */
+  return (size_t)(product ^ (product >> 32));
+}
+
+static site_entry_t* sites_find(site_entry_t* table,
+                                size_t capacity,
+                                const uvalue_t* block) {
+  size_t mask = capacity - 1;
+  for (size_t i = hash((uintptr_t)block >> 2) & mask; ; i = (i + 1) & mask) {
+    if (table[i].block == NULL || table[i].block == block)
+      return &table[i];
+  }
+}
+
+/* Rebuild the side table with the given capacity, replacing its blocks
+   by the ones returned by forward, if any, and dropping the dead ones */
+static void sites_rebuild(size_t capacity, uvalue_t* (*forward)(uvalue_t*)) {
+  site_entry_t* old_sites = sites;
+  size_t old_capacity = sites_capacity;
+
+  sites = calloc(capacity, sizeof(site_entry_t));
+  if (sites == NULL)
+    fail("cannot allocate memory for the heap profile");
+  sites_capacity = capacity;
+  sites_count = 0;
+
+  for (size_t i = 0; i < old_capacity; ++i) {
+    uvalue_t* block = old_sites[i].block;
+    if (block != NULL && forward != NULL)
+      block = forward(block);
+    if (block != NULL) {
+      site_entry_t* entry = sites_find(sites, sites_capacity, block);
+      entry->block = block;
+      entry->site = old_sites[i].site;
+      sites_count += 1;
+    }
+  }
+  free(old_sites);
+}
+
+void heap_profiler_record(uvalue_t* block, uvalue_t site) {
+  if (2 * (sites_count + 1) > sites_capacity)
+    sites_rebuild(sites_capacity == 0
+                  ? HEAP_PROFILER_INITIAL_CAPACITY
+                  : 2 * sites_capacity,
+                  NULL);
+  site_entry_t* entry = sites_find(sites, sites_capacity, block);
+  if (entry->block == NULL) {
+    entry->block = block;
+    sites_count += 1;
+  }
+  entry->site = site;
+}
+
+void heap_profiler_move(uvalue_t* (*forward)(uvalue_t* block)) {
+  if (sites_count > 0)
+    sites_rebuild(sites_capacity, forward);
+}
+
+// Census
+
+/* Group of surviving blocks with the same allocation site, tag and
+   size */
+typedef struct {
+  uvalue_t site;
+  uvalue_t tag;
+  uvalue_t size;
+  uint64_t count;               /* 0 for free entries */
+} census_group_t;
+
+static census_group_t* census_find(census_group_t* groups,
+                                   size_t capacity,
+                                   uvalue_t site,
+                                   uvalue_t tag,
+                                   uvalue_t size) {
+  size_t mask = capacity - 1;
+  uint64_t key = ((uint64_t)site << 32) ^ ((uint64_t)tag << 24) ^ size;
+  for (size_t i = hash(key) & mask; ; i = (i + 1) & mask) {
+    census_group_t* group = &groups[i];
+    if (group->count == 0
+        || (group->site == site && group->tag == tag && group->size == size))
+      return group;
+  }
+}
+
+static uint64_t group_bytes(const census_group_t* group) {
+  return group->count * (1 + (group->size != 0 ? group->size : 1))
+    * sizeof(uvalue_t);
+}
+
+static int group_compare_bytes(const void* v1, const void* v2) {
+  uint64_t b1 = group_bytes(v1);
+  uint64_t b2 = group_bytes(v2);
+  return (b1 < b2) - (b1 > b2);
+}
+
+void heap_profiler_census(uvalue_t* (*survivor)(uvalue_t* block)) {
+  heap_profiler_move(survivor);
+  collections += 1;
+  if (sites_count == 0)
+    return;
+
+  size_t capacity = sites_capacity;
+  census_group_t* groups = calloc(capacity, sizeof(census_group_t));
+  if (groups == NULL)
+    fail("cannot allocate memory for the heap profile");
+  size_t groups_count = 0;
+  for (size_t i = 0; i < sites_capacity; ++i) {
+    uvalue_t* block = sites[i].block;
+    if (block == NULL)
+      continue;
+    uvalue_t tag = memory_get_block_tag(block);
+    uvalue_t size = memory_get_block_size(block);
+    census_group_t* group =
+      census_find(groups, capacity, sites[i].site, tag, size);
+    if (group->count == 0) {
+      group->site = sites[i].site;
+      group->tag = tag;
+      group->size = size;
+      groups_count += 1;
+    }
+    group->count += 1;
+  }
+
+  /* Biggest groups first (free entries, with a count of 0, end up
+     last) */
+  qsort(groups, capacity, sizeof(census_group_t), group_compare_bytes);
+  for (size_t i = 0; i < groups_count; ++i) {
+    census_group_t* group = &groups[i];
+    fprintf(profile_file, "%lu,", collections);
+    symbols_write_name(profile_file, symbols_function(group->site));
+    fprintf(profile_file, ",0x%x,%u,%u,%llu,%llu\n",
+            group->site, group->tag, group->size,
+            (unsigned long long)group->count,
+            (unsigned long long)group_bytes(group));
+  }
+  free(groups);
+}
+
+void heap_profiler_stop(void) {
+  if (profile_file == NULL)
+    return;
+  fclose(profile_file);
+  profile_file = NULL;
+  free(sites);
+  sites = NULL;
+  sites_capacity = sites_count = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+
+#include <stdbool.h>
+#include "vmtypes.h"
+
+/* Heap profiler. The engine records the code address of the BALO or
+   RALO instruction which allocated each block, its allocation site, in
+   a side table keyed by the block. After each collection, the memory
+   system gives the blocks which survived it, and the profiler writes a
+   census of them to its file, aggregated by allocation site, tag and
+   size: one line per group, with the number of the collection, the
+   name of the function containing the site (see symbols.h), the site,
+   the tag, the size, and the number of blocks and of bytes (headers
+   included) of the group. */
+
+/* Start profiling, writing the censuses to the given file */
+void heap_profiler_start(char* file_name);
+
+/* Return true if the profiler was started */
+bool heap_profiler_is_running(void);
+
+/* Record the allocation of the given block by the instruction at the
+   given code address */
+void heap_profiler_record(uvalue_t* block, uvalue_t site);
+
+/* Take a census of the blocks which survived a collection. survivor
+   returns the address of the given block after the collection, or NULL
+   if it is dead. Its headers must still be valid. */
+void heap_profiler_census(uvalue_t* (*survivor)(uvalue_t* block));
+
+/* Update the blocks moved by the memory system, without taking a
+   census. forward returns the new address of the given block, or NULL
+   if it is dead. */
+void heap_profiler_move(uvalue_t* (*forward)(uvalue_t* block));
+
+/* Stop profiling, close the file and free the side table */
+void heap_profiler_stop(void);
+
+#endif // HEAP_PROFILER_H
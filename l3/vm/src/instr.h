@@ -0,0 +1,64 @@
+#ifndef INSTR_H
+#define INSTR_H
+
+#include "vmtypes.h"
+#include "opcode.h"
+
+/* Instruction decoding, shared by the engine and the JIT compiler */
+
+typedef enum {
+  Lb, Lb1, Lb2, Lb3, Lb4, Lb5,
+  Ib, Ob
+} reg_bank_t;
+
+static inline reg_bank_t reg_bank(reg_id_t r) {
+  return r >> 5;
+}
+
+static inline unsigned int reg_index(reg_id_t r) {
+  return r & 0x1F;
+}
+
+static inline unsigned int instr_extract_u(instr_t instr, int start, int len) {
+  return (instr >> start) & ((1 << len) - 1);
+}
+
+static inline int instr_extract_s(instr_t instr, int start, int len) {
+  int bits = (int)instr_extract_u(instr, start, len);
+  int m = 1 << (len - 1);
+  return (bits ^ m) - m;
+}
+
+static inline opcode_t instr_opcode(instr_t instr) {
+  unsigned int opcode = instr_extract_u(instr, 26, 6);
+  return (opcode_t)opcode;
+}
+
+static inline reg_id_t instr_ra(instr_t instr) {
+  return (reg_id_t)instr_extract_u(instr, 18, 8);
+}
+
+static inline reg_id_t instr_rb(instr_t instr) {
+  return (reg_id_t)instr_extract_u(instr, 10, 8);
+}
+
+static inline reg_id_t instr_rc(instr_t instr) {
+  return (reg_id_t)instr_extract_u(instr, 2, 8);
+}
+
+static inline int instr_d(instr_t instr) {
+  return instr_extract_s(instr, 0, 10);
+}
+
+/* Constant of the register-immediate arithmetic instructions */
+static inline int instr_s(instr_t instr) {
+  return instr_extract_s(instr, 0, 10);
+}
+
+/* Constant of the register-immediate conditional jumps, stored in
+   place of rb */
+static inline int instr_jump_s(instr_t instr) {
+  return instr_extract_s(instr, 10, 8);
+}
+
+#endif // INSTR_H
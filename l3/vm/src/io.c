@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 200809L /* for read and write */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "fail.h"
+
+#define IO_BUFFER_SIZE (64 * 1024)
+
+/* Number of bytes converted at once by io_read_block and io_write_block */
+#define IO_CHUNK_SIZE 4096
+
+static uint8_t in_buffer[IO_BUFFER_SIZE];
+static size_t in_next, in_end;      /* next and end of buffered input */
+
+static uint8_t out_buffer[IO_BUFFER_SIZE];
+static size_t out_end;              /* end of pending output */
+
+void io_setup(void) {
+  in_next = in_end = out_end = 0;
+  atexit(io_flush);
+}
+
+static void write_all(const uint8_t* bytes, size_t count) {
+  size_t written = 0;
+  while (written < count) {
+    ssize_t n = write(STDOUT_FILENO, bytes + written, count - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      out_end = 0;
+      fail("error while writing output");
+    }
+    written += (size_t)n;
+  }
+}
+
+void io_flush(void) {
+  write_all(out_buffer, out_end);
+  out_end = 0;
+}
+
+/* Refill the input buffer, return false at the end of the input */
+static bool io_refill(void) {
+  io_flush();
+  ssize_t n;
+  do {
+    n = read(STDIN_FILENO, in_buffer, IO_BUFFER_SIZE);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0)
+    fail("error while reading input");
+  in_next = 0;
+  in_end = (size_t)n;
+  return n > 0;
+}
+
+value_t io_read_byte(void) {
+  if (in_next == in_end && !io_refill())
+    return -1;
+  return in_buffer[in_next++];
+}
+
+void io_write_byte(uint8_t byte) {
+  if (out_end == IO_BUFFER_SIZE)
+    io_flush();
+  out_buffer[out_end++] = byte;
+}
+
+/* Read at most count bytes, return the number of bytes read, which is
+   less than count only at the end of the input */
+static size_t io_read_bytes(uint8_t* bytes, size_t count) {
+  size_t read_count = 0;
+  while (read_count < count && (in_next < in_end || io_refill())) {
+    size_t n = in_end - in_next;
+    if (n > count - read_count)
+      n = count - read_count;
+    memcpy(bytes + read_count, in_buffer + in_next, n);
+    in_next += n;
+    read_count += n;
+  }
+  return read_count;
+}
+
+static void io_write_bytes(const uint8_t* bytes, size_t count) {
+  if (count > IO_BUFFER_SIZE - out_end)
+    io_flush();
+  if (count >= IO_BUFFER_SIZE) {
+    write_all(bytes, count);
+  } else {
+    memcpy(out_buffer + out_end, bytes, count);
+    out_end += count;
+  }
+}
+
+uvalue_t io_read_block(uvalue_t* block, uvalue_t size) {
+  uint8_t bytes[IO_CHUNK_SIZE];
+  uvalue_t count = 0;
+  while (count < size) {
+    size_t wanted = size - count < IO_CHUNK_SIZE ? size - count : IO_CHUNK_SIZE;
+    size_t read_count = io_read_bytes(bytes, wanted);
+    for (size_t i = 0; i < read_count; ++i)
+      block[count + i] = ((uvalue_t)bytes[i] << 1) | 1;
+    count += (uvalue_t)read_count;
+    if (read_count < wanted)
+      break;
+  }
+  return count;
+}
+
+void io_write_block(const uvalue_t* block, uvalue_t size) {
+  uint8_t bytes[IO_CHUNK_SIZE];
+  for (uvalue_t start = 0; start < size; start += IO_CHUNK_SIZE) {
+    size_t count = size - start < IO_CHUNK_SIZE ? size - start : IO_CHUNK_SIZE;
+    for (size_t i = 0; i < count; ++i)
+      bytes[i] = (uint8_t)(block[start + i] >> 1);
+    io_write_bytes(bytes, count);
+  }
+}
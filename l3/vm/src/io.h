@@ -0,0 +1,32 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include "vmtypes.h"
+
+/* Buffered input and output of bytes, on the standard input and
+   output. The output is flushed when its buffer is full, before
+   waiting for input, on io_flush and on exit. */
+
+/* Setup the buffers */
+void io_setup(void);
+
+/* Read a byte, return -1 at the end of the input */
+value_t io_read_byte(void);
+
+/* Write a byte */
+void io_write_byte(uint8_t byte);
+
+/* Read bytes into the given block, whose elements are bytes represented
+   as tagged L3 integers, until it is full or the input ends. Return the
+   number of bytes read. */
+uvalue_t io_read_block(uvalue_t* block, uvalue_t size);
+
+/* Write the elements of the given block, which are bytes represented as
+   tagged L3 integers */
+void io_write_block(const uvalue_t* block, uvalue_t size);
+
+/* Write all pending output */
+void io_flush(void);
+
+#endif // IO_H
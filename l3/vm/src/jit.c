@@ -0,0 +1,629 @@
+#define _DEFAULT_SOURCE /* for MAP_ANONYMOUS */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "instr.h"
+#include "opcode.h"
+#include "fail.h"
+#include "memory.h"
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* A simple template-based JIT compiler for x86-64.
+ *
+ * Each supported instruction is translated by copying a short machine
+ * code template, in which the displacements of the (pseudo)registers
+ * and the branch offsets are patched. Instructions which are not
+ * supported (calls, returns, allocation, I/O, ...) are translated to
+ * an exit to the interpreter, which executes them and re-enters the
+ * native code at the following instruction.
+ *
+ * While native code runs, the base registers are kept in callee-saved
+ * machine registers: Lb in rbx, Ib in rbp and Ob in r15. The start of
+ * the memory, used to translate virtual addresses, is kept in r14.
+ * BSET marks the card of the field it writes when the memory system
+ * has a card table.
+ */
+
+#define JIT_MAX_FUNCTION_SIZE 8192 /* in instructions */
+
+static const instr_t* code;
+static size_t code_size;
+static uint8_t* card_table;
+
+typedef struct {
+  void* start;
+  size_t size;
+} mapping_t;
+
+static mapping_t* mappings;
+static size_t mappings_count;
+static size_t mappings_capacity;
+
+/******************** Code buffer ****************************/
+
+typedef struct {
+  uint8_t* bytes;
+  size_t size;
+  size_t capacity;
+} buffer_t;
+
+static void emit_u8(buffer_t* b, uint8_t byte) {
+  if (b->size == b->capacity) {
+    b->capacity = b->capacity == 0 ? 4096 : 2 * b->capacity;
+    b->bytes = realloc(b->bytes, b->capacity);
+    if (b->bytes == NULL)
+      fail("cannot allocate memory for native code");
+  }
+  b->bytes[b->size++] = byte;
+}
+
+static void emit_bytes(buffer_t* b, const uint8_t* bytes, size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    emit_u8(b, bytes[i]);
+}
+
+static void emit_u32(buffer_t* b, uint32_t word) {
+  for (int i = 0; i < 4; ++i)
+    emit_u8(b, (uint8_t)(word >> (8 * i)));
+}
+
+static void patch_u32(buffer_t* b, size_t offset, uint32_t word) {
+  for (int i = 0; i < 4; ++i)
+    b->bytes[offset + (size_t)i] = (uint8_t)(word >> (8 * i));
+}
+
+/******************** Branch fixups ****************************/
+
+#define EPILOGUE_TARGET SIZE_MAX
+
+typedef struct {
+  size_t offset;                /* offset of the rel32 field */
+  size_t target;                /* instruction index, or EPILOGUE_TARGET */
+} fixup_t;
+
+typedef struct {
+  fixup_t* elems;
+  size_t count;
+  size_t capacity;
+} fixups_t;
+
+static void emit_rel32(buffer_t* b, fixups_t* f, size_t target) {
+  if (f->count == f->capacity) {
+    f->capacity = f->capacity == 0 ? 256 : 2 * f->capacity;
+    f->elems = realloc(f->elems, f->capacity * sizeof(fixup_t));
+    if (f->elems == NULL)
+      fail("cannot allocate memory for native code");
+  }
+  f->elems[f->count++] = (fixup_t){ b->size, target };
+  emit_u32(b, 0);
+}
+
+/******************** Machine instructions ****************************/
+
+typedef enum {
+  RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+  R14 = 14, R15 = 15,
+  NO_INDEX = 0xFF
+} native_reg_t;
+
+/* Emit an instruction with a [base + index * 2^scale + disp32] memory
+   operand. */
+static void emit_mem(buffer_t* b,
+                     bool wide,
+                     const uint8_t* opcode,
+                     size_t opcode_len,
+                     unsigned int reg,
+                     native_reg_t base,
+                     native_reg_t index,
+                     unsigned int scale,
+                     int32_t disp) {
+  bool has_index = index != NO_INDEX;
+  unsigned int rex = 0x40
+    | (wide ? 0x08u : 0u)
+    | ((reg >> 3) & 1u) << 2
+    | (has_index ? ((index >> 3) & 1u) << 1 : 0u)
+    | ((base >> 3) & 1u);
+  if (rex != 0x40)
+    emit_u8(b, (uint8_t)rex);
+  emit_bytes(b, opcode, opcode_len);
+
+  bool has_sib = has_index || (base & 7) == RSP;
+  emit_u8(b, (uint8_t)(0x80 | (reg & 7) << 3 | (has_sib ? 4u : (base & 7))));
+  if (has_sib) {
+    unsigned int sib_index = has_index ? (index & 7u) : 4u;
+    emit_u8(b, (uint8_t)(scale << 6 | sib_index << 3 | (base & 7)));
+  }
+  emit_u32(b, (uint32_t)disp);
+}
+
+/* Native base register and displacement of a VM (pseudo-)register */
+static void vm_reg_location(reg_id_t r, native_reg_t* base, int32_t* disp) {
+  reg_bank_t bank = reg_bank(r);
+  unsigned int index = reg_index(r);
+  switch (bank) {
+  case Ib:
+    *base = RBP;
+    *disp = (int32_t)(index * sizeof(uvalue_t));
+    break;
+  case Ob:
+    *base = R15;
+    *disp = (int32_t)(index * sizeof(uvalue_t));
+    break;
+  default:
+    *base = RBX;
+    *disp = (int32_t)(((unsigned int)(bank - Lb) * 32 + index)
+                      * sizeof(uvalue_t));
+    break;
+  }
+}
+
+/* <op> native_reg, dword [VM register] */
+static void emit_op_vm_reg(buffer_t* b,
+                           const uint8_t* opcode,
+                           size_t opcode_len,
+                           unsigned int native_reg,
+                           reg_id_t vm_reg) {
+  native_reg_t base;
+  int32_t disp;
+  vm_reg_location(vm_reg, &base, &disp);
+  emit_mem(b, false, opcode, opcode_len, native_reg, base, NO_INDEX, 0, disp);
+}
+
+static const uint8_t op_mov_load[] = { 0x8B };
+static const uint8_t op_mov_store[] = { 0x89 };
+static const uint8_t op_mov_imm[] = { 0xC7 };
+static const uint8_t op_add[] = { 0x03 };
+static const uint8_t op_sub[] = { 0x2B };
+static const uint8_t op_and[] = { 0x23 };
+static const uint8_t op_or[] = { 0x0B };
+static const uint8_t op_xor[] = { 0x33 };
+static const uint8_t op_cmp[] = { 0x3B };
+static const uint8_t op_imul[] = { 0x0F, 0xAF };
+static const uint8_t op_idiv[] = { 0xF7 };
+static const uint8_t op_movzx_byte[] = { 0x0F, 0xB6 };
+static const uint8_t op_lea[] = { 0x8D };
+
+static void emit_load(buffer_t* b, native_reg_t native_reg, reg_id_t vm_reg) {
+  emit_op_vm_reg(b, op_mov_load, sizeof(op_mov_load), native_reg, vm_reg);
+}
+
+static void emit_store(buffer_t* b, reg_id_t vm_reg, native_reg_t native_reg) {
+  emit_op_vm_reg(b, op_mov_store, sizeof(op_mov_store), native_reg, vm_reg);
+}
+
+/* lea rcx, [r14 + rcx]: physical address of the block in rcx */
+static void emit_block_address(buffer_t* b) {
+  emit_mem(b, true, op_lea, sizeof(op_lea), RCX, R14, RCX, 0, 0);
+}
+
+/* Mark the card of the field of the block in rcx at the index in rdx */
+static void emit_mark_card(buffer_t* b) {
+  static const uint8_t lea_field[] = { 0x8D, 0x04, 0x91 };
+  static const uint8_t shr_card[] = { 0xC1, 0xE8, MEMORY_CARD_BITS };
+  static const uint8_t mov_rdi_imm64[] = { 0x48, 0xBF };
+  static const uint8_t mov_card[] = { 0xC6, 0x04, 0x07, 0x01 };
+  uint64_t table = (uint64_t)(uintptr_t)card_table;
+
+  emit_bytes(b, lea_field, sizeof(lea_field));   /* lea eax, [rcx + rdx*4] */
+  emit_bytes(b, shr_card, sizeof(shr_card));     /* shr eax, card bits */
+  emit_bytes(b, mov_rdi_imm64, sizeof(mov_rdi_imm64)); /* mov rdi, table */
+  emit_u32(b, (uint32_t)table);
+  emit_u32(b, (uint32_t)(table >> 32));
+  emit_bytes(b, mov_card, sizeof(mov_card));     /* mov byte [rdi + rax], 1 */
+}
+
+static void emit_exit(buffer_t* b, fixups_t* f, size_t index) {
+  emit_u8(b, 0xB8);                              /* mov eax, imm32 */
+  emit_u32(b, (uint32_t)index);
+  emit_u8(b, 0xE9);                              /* jmp rel32 */
+  emit_rel32(b, f, EPILOGUE_TARGET);
+}
+
+static void emit_prologue(buffer_t* b) {
+  static const uint8_t push_regs[] = {
+    0x53,                       /* push rbx */
+    0x55,                       /* push rbp */
+    0x41, 0x56,                 /* push r14 */
+    0x41, 0x57,                 /* push r15 */
+  };
+  static const uint8_t mov_r14_rsi[] = { 0x49, 0x89, 0xF6 };
+
+  emit_bytes(b, push_regs, sizeof(push_regs));
+  emit_mem(b, true, op_mov_load, sizeof(op_mov_load),
+           RBX, RDI, NO_INDEX, 0, Lb * (int32_t)sizeof(uvalue_t*));
+  emit_mem(b, true, op_mov_load, sizeof(op_mov_load),
+           RBP, RDI, NO_INDEX, 0, Ib * (int32_t)sizeof(uvalue_t*));
+  emit_mem(b, true, op_mov_load, sizeof(op_mov_load),
+           R15, RDI, NO_INDEX, 0, Ob * (int32_t)sizeof(uvalue_t*));
+  emit_bytes(b, mov_r14_rsi, sizeof(mov_r14_rsi));
+}
+
+static void emit_epilogue(buffer_t* b) {
+  static const uint8_t pop_regs_ret[] = {
+    0x41, 0x5F,                 /* pop r15 */
+    0x41, 0x5E,                 /* pop r14 */
+    0x5D,                       /* pop rbp */
+    0x5B,                       /* pop rbx */
+    0xC3,                       /* ret */
+  };
+  emit_bytes(b, pop_regs_ret, sizeof(pop_regs_ret));
+}
+
+/******************** Instruction templates ****************************/
+
+static bool is_supported(opcode_t opcode) {
+  switch (opcode) {
+  case opcode_ADD: case opcode_SUB: case opcode_MUL: case opcode_DIV:
+  case opcode_MOD: case opcode_LSL: case opcode_LSR: case opcode_AND:
+  case opcode_OR: case opcode_XOR:
+  case opcode_ADDI: case opcode_SUBI: case opcode_LSLI: case opcode_LSRI:
+  case opcode_ANDI: case opcode_ORI:
+  case opcode_JLT: case opcode_JLE: case opcode_JEQ: case opcode_JNE:
+  case opcode_JLTI: case opcode_JLEI: case opcode_JGTI: case opcode_JGEI:
+  case opcode_JEQI: case opcode_JNEI:
+  case opcode_JI:
+  case opcode_LDLO: case opcode_LDHI: case opcode_MOVE:
+  case opcode_BTAG: case opcode_BGET: case opcode_BSET:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void emit_arith(buffer_t* b, instr_t instr,
+                       const uint8_t* opcode, size_t opcode_len) {
+  emit_load(b, RAX, instr_rb(instr));
+  emit_op_vm_reg(b, opcode, opcode_len, RAX, instr_rc(instr));
+  emit_store(b, instr_ra(instr), RAX);
+}
+
+static void emit_division(buffer_t* b, instr_t instr, native_reg_t result) {
+  emit_load(b, RAX, instr_rb(instr));
+  emit_u8(b, 0x99);                              /* cdq */
+  emit_op_vm_reg(b, op_idiv, sizeof(op_idiv), 7, instr_rc(instr));
+  emit_store(b, instr_ra(instr), result);
+}
+
+static void emit_shift(buffer_t* b, instr_t instr, uint8_t modrm) {
+  emit_load(b, RAX, instr_rb(instr));
+  emit_load(b, RCX, instr_rc(instr));
+  emit_u8(b, 0xD3);                              /* shl/shr eax, cl */
+  emit_u8(b, modrm);
+  emit_store(b, instr_ra(instr), RAX);
+}
+
+/* <op> eax, imm32, given the short form of the opcode for eax */
+static void emit_arith_imm(buffer_t* b, instr_t instr, uint8_t opcode) {
+  emit_load(b, RAX, instr_rb(instr));
+  emit_u8(b, opcode);
+  emit_u32(b, (uint32_t)instr_s(instr));
+  emit_store(b, instr_ra(instr), RAX);
+}
+
+static void emit_shift_imm(buffer_t* b, instr_t instr, uint8_t modrm) {
+  emit_load(b, RAX, instr_rb(instr));
+  emit_u8(b, 0xC1);                              /* shl/shr eax, imm8 */
+  emit_u8(b, modrm);
+  emit_u8(b, (uint8_t)(instr_s(instr) & 0x1F));
+  emit_store(b, instr_ra(instr), RAX);
+}
+
+static void emit_cond_jump(buffer_t* b, fixups_t* f,
+                           instr_t instr, size_t index, uint8_t cc) {
+  emit_load(b, RAX, instr_ra(instr));
+  emit_op_vm_reg(b, op_cmp, sizeof(op_cmp), RAX, instr_rb(instr));
+  emit_u8(b, 0x0F);                              /* jcc rel32 */
+  emit_u8(b, cc);
+  emit_rel32(b, f, (size_t)((ptrdiff_t)index + instr_d(instr)));
+}
+
+static void emit_cond_jump_imm(buffer_t* b, fixups_t* f,
+                               instr_t instr, size_t index, uint8_t cc) {
+  emit_load(b, RAX, instr_ra(instr));
+  emit_u8(b, 0x3D);                              /* cmp eax, imm32 */
+  emit_u32(b, (uint32_t)instr_jump_s(instr));
+  emit_u8(b, 0x0F);                              /* jcc rel32 */
+  emit_u8(b, cc);
+  emit_rel32(b, f, (size_t)((ptrdiff_t)index + instr_d(instr)));
+}
+
+static void emit_instr(buffer_t* b, fixups_t* f, size_t index) {
+  instr_t instr = code[index];
+  switch (instr_opcode(instr)) {
+  case opcode_ADD: emit_arith(b, instr, op_add, sizeof(op_add)); break;
+  case opcode_SUB: emit_arith(b, instr, op_sub, sizeof(op_sub)); break;
+  case opcode_MUL: emit_arith(b, instr, op_imul, sizeof(op_imul)); break;
+  case opcode_AND: emit_arith(b, instr, op_and, sizeof(op_and)); break;
+  case opcode_OR: emit_arith(b, instr, op_or, sizeof(op_or)); break;
+  case opcode_XOR: emit_arith(b, instr, op_xor, sizeof(op_xor)); break;
+  case opcode_DIV: emit_division(b, instr, RAX); break;
+  case opcode_MOD: emit_division(b, instr, RDX); break;
+  case opcode_LSL: emit_shift(b, instr, 0xE0); break;
+  case opcode_LSR: emit_shift(b, instr, 0xE8); break;
+  case opcode_ADDI: emit_arith_imm(b, instr, 0x05); break;
+  case opcode_SUBI: emit_arith_imm(b, instr, 0x2D); break;
+  case opcode_ANDI: emit_arith_imm(b, instr, 0x25); break;
+  case opcode_ORI: emit_arith_imm(b, instr, 0x0D); break;
+  case opcode_LSLI: emit_shift_imm(b, instr, 0xE0); break;
+  case opcode_LSRI: emit_shift_imm(b, instr, 0xE8); break;
+
+  case opcode_JLT: emit_cond_jump(b, f, instr, index, 0x8C); break;
+  case opcode_JLE: emit_cond_jump(b, f, instr, index, 0x8E); break;
+  case opcode_JEQ: emit_cond_jump(b, f, instr, index, 0x84); break;
+  case opcode_JNE: emit_cond_jump(b, f, instr, index, 0x85); break;
+  case opcode_JLTI: emit_cond_jump_imm(b, f, instr, index, 0x8C); break;
+  case opcode_JLEI: emit_cond_jump_imm(b, f, instr, index, 0x8E); break;
+  case opcode_JGTI: emit_cond_jump_imm(b, f, instr, index, 0x8F); break;
+  case opcode_JGEI: emit_cond_jump_imm(b, f, instr, index, 0x8D); break;
+  case opcode_JEQI: emit_cond_jump_imm(b, f, instr, index, 0x84); break;
+  case opcode_JNEI: emit_cond_jump_imm(b, f, instr, index, 0x85); break;
+  case opcode_JI:
+    emit_u8(b, 0xE9);                            /* jmp rel32 */
+    emit_rel32(b, f, (size_t)((ptrdiff_t)index
+                              + instr_extract_s(instr, 0, 26)));
+    break;
+
+  case opcode_LDLO:
+    emit_op_vm_reg(b, op_mov_imm, sizeof(op_mov_imm), 0, instr_ra(instr));
+    emit_u32(b, (uint32_t)instr_extract_s(instr, 0, 18));
+    break;
+  case opcode_LDHI:
+    emit_load(b, RAX, instr_ra(instr));
+    emit_u8(b, 0x25);                            /* and eax, 0xFFFF */
+    emit_u32(b, 0xFFFF);
+    emit_u8(b, 0x0D);                            /* or eax, imm32 */
+    emit_u32(b, instr_extract_u(instr, 0, 16) << 16);
+    emit_store(b, instr_ra(instr), RAX);
+    break;
+  case opcode_MOVE:
+    emit_load(b, RAX, instr_rb(instr));
+    emit_store(b, instr_ra(instr), RAX);
+    break;
+
+  case opcode_BTAG:
+    /* movzx eax, byte [r14 + rcx - 4] (tag is the low byte of the header) */
+    emit_load(b, RCX, instr_rb(instr));
+    emit_mem(b, false, op_movzx_byte, sizeof(op_movzx_byte),
+             RAX, R14, RCX, 0, -(int32_t)sizeof(uvalue_t));
+    emit_store(b, instr_ra(instr), RAX);
+    break;
+  case opcode_BGET:
+    emit_load(b, RCX, instr_rb(instr));
+    emit_load(b, RDX, instr_rc(instr));
+    emit_block_address(b);
+    emit_mem(b, false, op_mov_load, sizeof(op_mov_load),
+             RAX, RCX, RDX, 2, 0);
+    emit_store(b, instr_ra(instr), RAX);
+    break;
+  case opcode_BSET:
+    emit_load(b, RCX, instr_rb(instr));
+    emit_load(b, RDX, instr_rc(instr));
+    if (card_table != NULL)
+      emit_mark_card(b);
+    emit_block_address(b);
+    emit_load(b, RAX, instr_ra(instr));
+    emit_mem(b, false, op_mov_store, sizeof(op_mov_store),
+             RAX, RCX, RDX, 2, 0);
+    break;
+
+  default:
+    emit_exit(b, f, index);
+    break;
+  }
+}
+
+/******************** Function compilation ****************************/
+
+/* Mark all instructions reachable from entry without going through a
+   call, return or halt. Return false if the function is too big or
+   jumps outside of the code area. */
+static bool explore_function(size_t entry, bool in_function[]) {
+  size_t* worklist = malloc((2 * JIT_MAX_FUNCTION_SIZE + 1) * sizeof(size_t));
+  if (worklist == NULL)
+    fail("cannot allocate memory for JIT compiler");
+
+  size_t worklist_size = 0, function_size = 0;
+  bool ok = true;
+  worklist[worklist_size++] = entry;
+  while (ok && worklist_size > 0) {
+    size_t index = worklist[--worklist_size];
+    if (index >= code_size) {
+      ok = false;
+      break;
+    }
+    if (in_function[index])
+      continue;
+    if (++function_size > JIT_MAX_FUNCTION_SIZE) {
+      ok = false;
+      break;
+    }
+    in_function[index] = true;
+
+    instr_t instr = code[index];
+    ptrdiff_t target = (ptrdiff_t)index;
+    switch (instr_opcode(instr)) {
+    case opcode_JLT: case opcode_JLE: case opcode_JEQ: case opcode_JNE:
+    case opcode_JLTI: case opcode_JLEI: case opcode_JGTI: case opcode_JGEI:
+    case opcode_JEQI: case opcode_JNEI:
+      target += instr_d(instr);
+      worklist[worklist_size++] = index + 1;
+      worklist[worklist_size++] = (size_t)target;
+      break;
+    case opcode_JI:
+      target += instr_extract_s(instr, 0, 26);
+      worklist[worklist_size++] = (size_t)target;
+      break;
+    case opcode_TCAL: case opcode_RET: case opcode_HALT:
+      break;
+    default:
+      worklist[worklist_size++] = index + 1;
+      break;
+    }
+  }
+
+  free(worklist);
+  return ok;
+}
+
+/* Native code can be entered at the start of the function and after
+   every instruction executed by the interpreter, provided the
+   instruction at which it is entered is supported. */
+static bool is_entry(size_t entry, size_t index, const bool in_function[]) {
+  if (!is_supported(instr_opcode(code[index])))
+    return false;
+  if (index == entry)
+    return true;
+  if (index == 0 || !in_function[index - 1])
+    return false;
+  switch (instr_opcode(code[index - 1])) {
+  case opcode_TCAL: case opcode_RET: case opcode_HALT:
+    return false;
+  default:
+    return !is_supported(instr_opcode(code[index - 1]));
+  }
+}
+
+static void* install_native_code(const buffer_t* b) {
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (b->size + page_size - 1) & ~(page_size - 1);
+
+  void* start = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (start == MAP_FAILED)
+    fail("cannot allocate executable memory");
+  memcpy(start, b->bytes, b->size);
+  if (mprotect(start, size, PROT_READ | PROT_EXEC) != 0)
+    fail("cannot make native code executable");
+
+  if (mappings_count == mappings_capacity) {
+    mappings_capacity = mappings_capacity == 0 ? 16 : 2 * mappings_capacity;
+    mappings = realloc(mappings, mappings_capacity * sizeof(mapping_t));
+    if (mappings == NULL)
+      fail("cannot allocate memory for JIT compiler");
+  }
+  mappings[mappings_count++] = (mapping_t){ start, size };
+  return start;
+}
+
+bool jit_compile_function(size_t entry,
+                          bool in_function[],
+                          jit_code_t native_entries[]) {
+  bool* function = calloc(code_size, sizeof(bool));
+  size_t* offsets = calloc(code_size, sizeof(size_t));
+  size_t* entry_offsets = calloc(code_size, sizeof(size_t));
+  if (function == NULL || offsets == NULL || entry_offsets == NULL)
+    fail("cannot allocate memory for JIT compiler");
+
+  buffer_t b = { NULL, 0, 0 };
+  fixups_t f = { NULL, 0, 0 };
+  size_t entries_count = 0;
+
+  bool ok = explore_function(entry, function);
+  if (ok) {
+    // Entry stubs
+    for (size_t i = 0; i < code_size; ++i) {
+      if (function[i] && is_entry(entry, i, function)) {
+        entry_offsets[i] = b.size + 1; /* 0 means "not an entry" */
+        emit_prologue(&b);
+        emit_u8(&b, 0xE9);                       /* jmp rel32 */
+        emit_rel32(&b, &f, i);
+        entries_count += 1;
+      }
+    }
+    ok = entries_count > 0;
+  }
+
+  if (ok) {
+    // Instructions, in order, so that fall-through needs no jump
+    for (size_t i = 0; i < code_size; ++i) {
+      if (function[i]) {
+        offsets[i] = b.size;
+        emit_instr(&b, &f, i);
+      }
+    }
+    size_t epilogue_offset = b.size;
+    emit_epilogue(&b);
+
+    for (size_t i = 0; i < f.count; ++i) {
+      fixup_t fixup = f.elems[i];
+      size_t target = fixup.target == EPILOGUE_TARGET
+        ? epilogue_offset
+        : offsets[fixup.target];
+      assert(fixup.target == EPILOGUE_TARGET || function[fixup.target]);
+      patch_u32(&b, fixup.offset,
+                (uint32_t)((int64_t)target - (int64_t)(fixup.offset + 4)));
+    }
+
+    char* native_code = install_native_code(&b);
+    for (size_t i = 0; i < code_size; ++i) {
+      if (function[i])
+        in_function[i] = true;
+      if (entry_offsets[i] != 0) {
+        void* native_entry = native_code + entry_offsets[i] - 1;
+        native_entries[i] = (jit_code_t)(uintptr_t)native_entry;
+      }
+    }
+  }
+
+  free(f.elems);
+  free(b.bytes);
+  free(entry_offsets);
+  free(offsets);
+  free(function);
+  return ok;
+}
+
+void jit_setup(const instr_t* code_start, size_t size) {
+  code = code_start;
+  code_size = size;
+  card_table = memory_get_card_table();
+}
+
+void jit_cleanup(void) {
+  for (size_t i = 0; i < mappings_count; ++i)
+    munmap(mappings[i].start, mappings[i].size);
+  free(mappings);
+  mappings = NULL;
+  mappings_count = mappings_capacity = 0;
+  code = NULL;
+  code_size = 0;
+}
+
+bool jit_is_supported(void) {
+  return true;
+}
+
+#else
+
+void jit_setup(const instr_t* code_start, size_t size) {
+  (void)code_start;
+  (void)size;
+}
+
+void jit_cleanup(void) {
+  // nothing to do
+}
+
+bool jit_is_supported(void) {
+  return false;
+}
+
+bool jit_compile_function(size_t entry,
+                          bool in_function[],
+                          jit_code_t native_entries[]) {
+  (void)entry;
+  (void)in_function;
+  (void)native_entries;
+  return false;
+}
+
+#endif
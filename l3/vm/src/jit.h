@@ -0,0 +1,32 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "vmtypes.h"
+
+/* Native code for a part of a function. It takes the (pseudo)base
+   registers and the start of the memory, runs until it reaches an
+   instruction it does not support, and returns the index of that
+   instruction, at which the interpreter must resume. */
+typedef uint32_t (*jit_code_t)(uvalue_t** R, void* memory_start);
+
+/* Setup the JIT compiler for the given code area */
+void jit_setup(const instr_t* code, size_t code_size);
+
+/* Tear down the JIT compiler, freeing all native code */
+void jit_cleanup(void);
+
+/* Return true if the JIT compiler is supported on this platform */
+bool jit_is_supported(void);
+
+/* Compile the function starting at instruction index entry. On
+   success, in_function[i] is set for all instructions of the function,
+   and native_entries[i] to the native code starting at instruction i
+   for all instructions at which the interpreter can enter native
+   code. Return false if the function cannot be compiled. */
+bool jit_compile_function(size_t entry,
+                          bool in_function[],
+                          jit_code_t native_entries[]);
+
+#endif // JIT_H
@@ -2,28 +2,72 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdalign.h>
+#include <stdbool.h>
 #include <assert.h>
 
 #include "memory.h"
 #include "engine.h"
+#include "jit.h"
+#include "io.h"
+#include "statistics.h"
+#include "heap_profiler.h"
+#include "symbols.h"
+#include "executable.h"
 #include "fail.h"
 
 typedef struct {
   size_t memory_size;
+  size_t frames_size;
   char* file_name;
+  char* profile_file_name;
+  char* sample_file_name;
+  char* statistics_file_name;
+  char* heap_profile_file_name;
+  size_t heap_min_size;
+  size_t heap_max_size;
+  unsigned int gc_target;
+  unsigned int gc_threads;
+  bool gc_compact;
+  bool huge_pages;
+  bool jit;
 } options_t;
 
-static options_t default_options = { 1000000, NULL };
+/* By default, the register-frame stack takes that fraction of memory */
+#define DEFAULT_FRAMES_FRACTION 8
+
+static options_t default_options =
+  { 1000000, SIZE_MAX, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 1, false, false, false };
 
 // Argument parsing
 
 static void display_usage(char* prog_name) {
   printf("Usage: %s [<options>] <asm_file>\n", prog_name);
   printf("\noptions:\n");
+  printf("  -c         compact the heap at every garbage collection\n");
+  printf("  -f <size>  set register-frame stack size in bytes"
+         " (default 1/%d of memory)\n", DEFAULT_FRAMES_FRACTION);
   printf("  -h         display this help message and exit\n");
+  printf("  -H <file>  write a census of the heap by allocation site to file"
+         " after each GC\n");
+  printf("  -j         compile hot functions to native code\n");
+  printf("  -L         back memory with transparent huge pages\n");
   printf("  -m <size>  set memory size in bytes (default %zd)\n",
          default_options.memory_size);
+#ifdef ENGINE_PROFILE
+  printf("  -p <file>  write execution profile to file\n");
+#endif
+  printf("  -P <file>  write sampled call stacks to file, symbolized"
+         " using <asm_file>.sym\n");
+  printf("  -s <file>  write memory statistics to file, as JSON\n");
+  printf("  -t <count> set number of garbage collection threads (default %u)\n",
+         default_options.gc_threads);
   printf("  -v         display version and exit\n");
+  printf("  --heap-min <size>   set minimal heap size in bytes"
+         " (default: initial size)\n");
+  printf("  --heap-max <size>   set maximal heap size in bytes"
+         " (default: initial size)\n");
+  printf("  --gc-target <pct>   grow the heap when more than <pct>%% of it"
+         " is live after a GC\n");
 }
 
 static void parse_args(int argc, char* argv[], options_t* opts) {
@@ -42,6 +86,70 @@ static void parse_args(int argc, char* argv[], options_t* opts) {
         opts->memory_size = strtoul(argv[i++], NULL, 10);
       } break;
 
+      case 'c': {
+        opts->gc_compact = true;
+      } break;
+
+      case 'f': {
+        if (i >= argc) {
+          display_usage(argv[0]);
+          fail("missing argument to -f");
+        }
+        opts->frames_size = strtoul(argv[i++], NULL, 10);
+      } break;
+
+#ifdef ENGINE_PROFILE
+      case 'p': {
+        if (i >= argc) {
+          display_usage(argv[0]);
+          fail("missing argument to -p");
+        }
+        opts->profile_file_name = argv[i++];
+      } break;
+#endif
+
+      case 'P': {
+        if (i >= argc) {
+          display_usage(argv[0]);
+          fail("missing argument to -P");
+        }
+        opts->sample_file_name = argv[i++];
+      } break;
+
+      case 's': {
+        if (i >= argc) {
+          display_usage(argv[0]);
+          fail("missing argument to -s");
+        }
+        opts->statistics_file_name = argv[i++];
+      } break;
+
+      case 't': {
+        if (i >= argc) {
+          display_usage(argv[0]);
+          fail("missing argument to -t");
+        }
+        opts->gc_threads = (unsigned int)strtoul(argv[i++], NULL, 10);
+      } break;
+
+      case 'j': {
+        if (!jit_is_supported())
+          fail("native code compilation not supported on this platform");
+        opts->jit = true;
+      } break;
+
+      case 'L': {
+        opts->huge_pages = true;
+      } break;
+
+      case 'H': {
+        if (i >= argc) {
+          display_usage(argv[0]);
+          fail("missing argument to -H");
+        }
+        opts->heap_profile_file_name = argv[i++];
+      } break;
+
       case 'h': {
         display_usage(argv[0]);
         exit(0);
@@ -57,6 +165,24 @@ static void parse_args(int argc, char* argv[], options_t* opts) {
         display_usage(argv[0]);
         fail("invalid option %s", arg);
       }
+    } else if (arg_len > 2 && arg[0] == '-' && arg[1] == '-') {
+      if (i >= argc) {
+        display_usage(argv[0]);
+        fail("missing argument to %s", arg);
+      }
+      unsigned long value = strtoul(argv[i++], NULL, 10);
+      if (strcmp(arg, "--heap-min") == 0)
+        opts->heap_min_size = value;
+      else if (strcmp(arg, "--heap-max") == 0)
+        opts->heap_max_size = value;
+      else if (strcmp(arg, "--gc-target") == 0) {
+        if (value == 0 || value > 100)
+          fail("invalid GC target %lu", value);
+        opts->gc_target = (unsigned int)value;
+      } else {
+        display_usage(argv[0]);
+        fail("invalid option %s", arg);
+      }
     } else
       opts->file_name = arg;
   }
@@ -76,7 +202,7 @@ static void* align_up(void* address, size_t align) {
   return (void*)aligned_address;
 }
 
-// ASM file loading
+// ASM file loading (executable files are mapped, see executable.h)
 
 static void load_file(char* file_name, instr_t** instr_ptr) {
   FILE* file = fopen(file_name, "r");
@@ -96,6 +222,38 @@ static void load_file(char* file_name, instr_t** instr_ptr) {
   fclose(file);
 }
 
+/* Load the symbols used by the profilers from the symbol map written
+   next to the assembly file */
+static void load_symbols(char* file_name) {
+  char* symbols_file_name = malloc(strlen(file_name) + sizeof(".sym"));
+  if (symbols_file_name == NULL)
+    fail("cannot allocate memory for file name");
+  strcpy(symbols_file_name, file_name);
+  strcat(symbols_file_name, ".sym");
+  if (!symbols_load(symbols_file_name))
+    fprintf(stderr, "warning: cannot open %s, "
+            "code addresses are written instead of function names\n",
+            symbols_file_name);
+  free(symbols_file_name);
+}
+
+/* Load the liveness maps written by the compiler next to the program,
+   if any, in a file whose name is the one of the program with its
+   extension replaced by .live (out.live for out.asm and out.l3x).
+   Without them, frames are scanned conservatively. */
+static void load_liveness(char* file_name) {
+  char* liveness_file_name = malloc(strlen(file_name) + sizeof(".live"));
+  if (liveness_file_name == NULL)
+    fail("cannot allocate memory for file name");
+  strcpy(liveness_file_name, file_name);
+  char* extension = strrchr(liveness_file_name, '.');
+  if (extension != NULL && strchr(extension, '/') == NULL)
+    *extension = '\0';
+  strcat(liveness_file_name, ".live");
+  engine_load_liveness(liveness_file_name);
+  free(liveness_file_name);
+}
+
 int main(int argc, char* argv[]) {
   options_t options = default_options;
   parse_args(argc, argv, &options);
@@ -103,21 +261,73 @@ int main(int argc, char* argv[]) {
     display_usage(argv[0]);
     fail("missing input file name");
   }
+#ifdef ENGINE_PROFILE
+  if (options.jit && options.profile_file_name != NULL)
+    fail("native code is not profiled, -j and -p cannot be combined");
+#endif
   if (options.memory_size == 0)
     fail("invalid memory size %zd", options.memory_size);
+  if (options.gc_threads == 0)
+    fail("invalid number of threads %u", options.gc_threads);
+  if (options.frames_size == SIZE_MAX)
+    options.frames_size = options.memory_size / DEFAULT_FRAMES_FRACTION;
 
   const int value_align = alignof(value_t);
 
+  io_setup();
+  if (options.statistics_file_name != NULL)
+    statistics_enable();
+  memory_set_gc_threads(options.gc_threads);
+  memory_set_compact_always(options.gc_compact);
+  memory_set_huge_pages(options.huge_pages);
+  memory_set_heap_limits(options.heap_min_size,
+                         options.heap_max_size,
+                         options.gc_target);
   memory_setup(align_down(options.memory_size, value_align));
   engine_setup();
+#ifdef ENGINE_PROFILE
+  engine_set_profile_file(options.profile_file_name);
+#endif
+  if (options.jit)
+    engine_enable_jit();
+
+  executable_t executable;
+  bool is_executable = executable_map(options.file_name, &executable);
+  void* code_end;
+  if (is_executable)
+    code_end = engine_use_code(executable.code, executable.code_size);
+  else {
+    instr_t* instr_ptr = memory_get_start();
+    load_file(options.file_name, &instr_ptr);
+    code_end = instr_ptr;
+  }
+  load_liveness(options.file_name);
+
+  if (options.sample_file_name != NULL
+      || options.heap_profile_file_name != NULL) {
+    if (is_executable && executable.symbols != NULL)
+      executable_for_each_symbol(&executable, symbols_add);
+    else
+      load_symbols(options.file_name);
+  }
+  if (options.sample_file_name != NULL)
+    engine_set_sample_file(options.sample_file_name);
+  if (options.heap_profile_file_name != NULL)
+    heap_profiler_start(options.heap_profile_file_name);
 
-  instr_t* instr_ptr = memory_get_start();
-  load_file(options.file_name, &instr_ptr);
-  memory_set_heap_start(align_up(instr_ptr, value_align));
+  void* frames_start = align_up(code_end, value_align);
+  memory_set_heap_start(engine_setup_frames(frames_start,
+                                            options.frames_size));
   uvalue_t halt_code = engine_run();
 
   engine_cleanup();
+  heap_profiler_stop();
+  symbols_cleanup();
+  if (is_executable)
+    executable_unmap(&executable);
   memory_cleanup();
+  if (options.statistics_file_name != NULL)
+    statistics_write(options.statistics_file_name, memory_get_identity());
 
   return (int)halt_code;
 }
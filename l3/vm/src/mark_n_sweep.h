@@ -5,14 +5,24 @@
 #include "vmtypes.h"
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
 
 #define HEADER_SIZE 1
-#define NB_FREE_LISTS 64 // I get better performance with 64 (compared to 32), specially with test/maze.asm Input: 35 1
-
-typedef struct {
-    uvalue_t* first;
-    uvalue_t* last;
-} seg_list;
+#define MAX_BLOCK_SIZE 0xFFFFFFu // Biggest size that fits in a header
+#define FREE_LISTS_SL_BITS 5 // Second-level free lists per power of 2: 2^FREE_LISTS_SL_BITS
+#define FREE_LISTS_SL_COUNT (1u << FREE_LISTS_SL_BITS)
+#define FREE_LISTS_FL_COUNT (24 - FREE_LISTS_SL_BITS + 1) // First-level free lists, up to MAX_BLOCK_SIZE
+#define ALLOCATION_BUFFER_SIZE 1024u // Words of the allocation buffers taken from the free lists
+#define ALLOCATION_BUFFER_MIN_SIZE 64u // Words of the smallest buffers taken when the heap is fragmented
+#define LARGE_BLOCK_SIZE 4096u // Words from which blocks are allocated in the large-object space
+#define SWEEP_STEP_SIZE 4096u // Words of the heap swept by each step of the lazy sweep
+#define HEAP_CHUNK_SIZE (1u << 18) // Words by which the heap grows and shrinks (1 MB)
+#define HEAP_TARGET_DEFAULT 60 // Percentage of the heap which should be live after a collection
+#define HEAP_SHRINK_COLLECTIONS 3 // Collections with a low occupancy after which the heap shrinks
+#define MARK_STACK_SIZE 4096 // Entries of the mark stack, beyond which the heap is rescanned
+#define MARK_PREFETCH_DISTANCE 8 // Blocks whose header is prefetched before they are scanned
+#define MARK_SHARED_SIZE 256 // Entries of the stack of a marker that other markers can steal
+#define MARK_SHARE_THRESHOLD 64 // Entries of the stack of a marker beyond which it shares some
 
 /******************** Block size utils functions ****************************/
 /**
@@ -24,47 +34,32 @@ typedef struct {
  */
 bool is_valid_size_block(const uvalue_t block, const uvalue_t size);
 
+/******************** Free lists management ****************************/
 /**
- * Check if the new candidate block is better than the current best block.
- * @param current_best Pointer to the current best block
- * @param candidate Pointer to a new candidate block
- * @param requested_size The requested block size
- * @return true if the the new candidate block is better, false otherwise
+ * Compute the indices of the free list containing the blocks of the given size.
+ * @param size The size of the blocks
+ * @param fl The first-level index, i.e. the position of the most significant bit of size
+ * @param sl The second-level index, i.e. the next bits of size
  */
-bool is_best_fit(const uvalue_t* current_best, const uvalue_t* candidate, const uvalue_t requested_size);
+void free_list_index(const uvalue_t size, unsigned int* fl, unsigned int* sl);
 
-/******************** Free lists management ****************************/
 /**
  * Reset the content of all the free lists
  */
 void reset_free_lists(void);
 
 /**
- * Remove the first element from the free list at position index, and
- * update the free list accordingly.
- * @param index The index of the free list to be modified
- */
-void remove_first_from_free_list(const uvalue_t index);
-
-/**
- * Add a new block at the end of the corresponding free list.
+ * Add a new block at the start of the corresponding free list, in constant time.
  * @param block The block that needs to be added
  */
 void add_to_free_list(uvalue_t* block);
 
 /**
- * Find the best block in the last free list containing blocks with variable sizes.
- * It also updates the free list accordingly if a block is found, and if a split is
- * needed, the split block will be added to the correct free list.
- * @param size The requested size of the block
- * @return pointer to a block of the requested size, or NULL if none exist.
- */
-uvalue_t* find_best_free_block(const uvalue_t size);
-
-/**
- * Find the best block in one of the free lists with fixed sizes. If these lists are empty or don't contain
- * enough space to return a block of the requested size, it search for a free block in the last free list.
- * It also update the free list accordingly if a block is found.
+ * Find a free block of the requested size in constant time, using the bitmaps
+ * of the non-empty free lists. It is an exact fit taken from the list of the
+ * requested size if that size is small, and otherwise the first block of the
+ * first non-empty list whose blocks are all big enough to be split. The split
+ * block is added to the corresponding free list.
  * @param size The requested size of the block
  * @return pointer to a block of the requested size, or NULL if none exist.
  */
@@ -91,36 +86,107 @@ void unset_block_bitmap(const uvalue_t* block);
 bool is_block(uvalue_t* block);
 
 
-/******************** Mark And Sweep ****************************/
 /**
- * Checks if two block are consecutive in memory.
- * @param b1 The first block
- * @param b2 The second block
- * @return true if the block are consecutive, otherwise false.
+ * Check if a pointer is a block of the heap or of the large-object space.
+ * @param block The block to check
+ * @return true if the pointer is a block, false otherwise.
  */
-bool can_coalesce(const uvalue_t* b1, const uvalue_t* b2);
+bool is_block_or_large(uvalue_t* block);
 
+/******************** Mark And Sweep ****************************/
 /**
- * Marking phase starting at the given root.
+ * Marking phase starting at the given root, which sets the bits of the
+ * reachable blocks in the mark bitmap. It uses an explicit mark stack
+ * of bounded size instead of recursion, and rescans the marked blocks
+ * if the stack overflows.
  * @param root The starting point of the marking phase.
  */
 void mark(uvalue_t* root);
 
 /**
- * Sweeping phase
+ * Mark all the values of the register frames located between start and
+ * end (the register-frame stack), which are roots.
+ * @param start The start of the frames
+ * @param end The end of the frames
+ */
+void mark_frames(uvalue_t* start, uvalue_t* end);
+
+/**
+ * Parallel marking phase, starting at the roots of the engine, which are
+ * distributed over the markers. Each one runs in its own thread, and
+ * steals blocks shared by the others when its stack is empty.
+ */
+void mark_parallel(void);
+
+/**
+ * Start the sweeping phase, which is then performed lazily by sweep_step,
+ * when the free lists do not contain a block big enough for an allocation,
+ * and by the background sweeper thread if there is one.
+ */
+void sweep_start(void);
+
+/**
+ * Sweep the next SWEEP_STEP_SIZE words of the heap, one word of the bitmaps
+ * at a time: the blocks which are not marked are freed, and the memory
+ * between live blocks is added to the free lists, without reading the
+ * headers of free and dead blocks.
+ * @return false if the whole heap was already swept, true otherwise
+ */
+bool sweep_step(void);
+
+/**
+ * Complete sweeping phase
  */
 void sweep(void);
 
 /**
- * Collect the memory by calling mark and sweep methods
+ * Collect the memory by calling the mark method, once the previous sweeping
+ * phase is complete, and starting a new sweeping phase, which is completed
+ * and followed by a compaction if every collection compacts the heap.
+ * The frames of the engine are scanned entirely, unless it has liveness
+ * maps, in which case only their live registers are roots.
  */
 void gc_collect(void);
 
+/******************** Compaction ****************************/
+/**
+ * Slide all the allocated blocks towards the start of the heap, in order,
+ * and update the pointers to them, in blocks and in the roots of the engine,
+ * using a forwarding table computed from the bitmap. The memory after the
+ * last block is then allocated by bumping a pointer, until the next
+ * collection. The heap must be completely swept.
+ */
+void compact(void);
+
+/******************** Heap sizing ****************************/
+/**
+ * Set the size of the heap, committing or releasing the memory after it.
+ * The heap must be completely swept, and have no block after its new end.
+ * @param size The new size of the heap, in words
+ */
+void heap_set_size(const size_t size);
+
+/**
+ * Grow or shrink the heap according to its occupancy, at the end of a sweep.
+ * Shrinking first lowers the limit before which blocks are allocated.
+ * @param live_end The end of the last live block
+ */
+void heap_resize(uvalue_t* live_end);
+
+/**
+ * Grow the heap up to its end if it has a lower limit, and otherwise enough
+ * for a block of the given size, if the maximal size of the heap allows it.
+ * The new memory is added to the free lists.
+ * @param block_size The size of the block that could not be allocated
+ * @return true if the heap was grown, false otherwise
+ */
+bool heap_grow(const uvalue_t block_size);
+
 /******************** Memory Management ****************************/
 /**
- * Allocate the bitmap at the beginning of the heap, and update
- * the heap pointer accordingly.
- * @param heap_size Size of the heap
+ * Allocate the allocation and mark bitmaps at the beginning of the heap,
+ * and update the heap pointer accordingly.
+ * @param heap_size Maximal size of the heap
  */
 void bitmap_allocation(const size_t heap_size);
 
@@ -2,6 +2,8 @@
 #define MEMORY_H
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include "vmtypes.h"
 
 typedef enum {
@@ -17,6 +19,31 @@ char* memory_get_identity(void);
 /* Setup the memory allocator and garbage collector */
 void memory_setup(size_t total_size);
 
+/* Set the minimal and maximal sizes of the heap, in bytes, and the
+   percentage of it which should be live after a collection, before
+   memory_setup. 0 stands for the default: the heap keeps the size it
+   has after the code and frames are loaded. Memory systems whose heap
+   has a fixed size fail unless all are 0. */
+void memory_set_heap_limits(size_t min_size,
+                            size_t max_size,
+                            unsigned int target);
+
+/* Make every collection compact the heap, instead of only the ones
+   after which the free memory is too fragmented for an allocation,
+   before memory_setup. Memory systems which do not compact fail if
+   always is true. */
+void memory_set_compact_always(bool always);
+
+/* Set the number of threads of the garbage collector, before
+   memory_setup. Memory systems which do not use threads fail unless it
+   is 1. */
+void memory_set_gc_threads(unsigned int count);
+
+/* Ask the system to back the memory with transparent huge pages, to
+   reduce TLB misses when traversing big heaps, before memory_setup.
+   It is ignored where they are not supported. */
+void memory_set_huge_pages(bool huge);
+
 /* Tear down the memory */
 void memory_cleanup(void);
 
@@ -32,10 +59,57 @@ void memory_set_heap_start(void* heap_start);
 /* Allocate block, return physical pointer to the new block */
 uvalue_t* memory_allocate(tag_t tag, uvalue_t size);
 
+/* Allocation buffer, i.e. free memory in which blocks are allocated by
+   bumping top, as long as they fit before end. The memory system only
+   learns about the blocks allocated in it when it is refilled, or
+   before a collection. An empty buffer has equal top and end. */
+typedef struct {
+  uvalue_t* top;
+  uvalue_t* end;
+} memory_buffer_t;
+
+/* Get the allocation buffer of the memory system, which stays the same
+   until memory_cleanup, but whose contents change on every call to the
+   memory system that allocates */
+memory_buffer_t* memory_get_buffer(void);
+
+/* Allocate a block which does not fit in the allocation buffer,
+   refilling it if possible. Return physical pointer to the new block. */
+uvalue_t* memory_buffer_refill(tag_t tag, uvalue_t size);
+
+/* Allocate a block in the given allocation buffer, or out of line once
+   it is full. Return physical pointer to the new block, which follows
+   its one-word header and takes at least one word, as blocks of size 0
+   hold a link when free. */
+static inline uvalue_t* memory_buffer_allocate(memory_buffer_t* buffer,
+                                               tag_t tag,
+                                               uvalue_t size) {
+  uvalue_t* block = buffer->top;
+  size_t words = 1 + (size != 0 ? (size_t)size : 1);
+  if ((size_t)(buffer->end - block) < words)
+    return memory_buffer_refill(tag, size);
+  buffer->top = block + words;
+  *block = (size << 8) | (uvalue_t)tag;
+  return block + 1;
+}
+
 /* Unpack block size from a physical pointer */
 uvalue_t memory_get_block_size(uvalue_t* block);
 
 /* Unpack block tag from a physical pointer */
 tag_t memory_get_block_tag(uvalue_t* block);
 
+/* Card table of the write barrier, or NULL if the memory system does
+   not need one. Card i covers the virtual addresses whose value,
+   shifted right by MEMORY_CARD_BITS, is i. */
+#define MEMORY_CARD_BITS 9
+uint8_t* memory_get_card_table(void);
+
+/* Write barrier: mark the card of the field at the given virtual
+   address, before it is modified by BSET */
+static inline void memory_mark_card(uint8_t* card_table, uvalue_t v_field) {
+  if (card_table != NULL)
+    card_table[v_field >> MEMORY_CARD_BITS] = 1;
+}
+
 #endif
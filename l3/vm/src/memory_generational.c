@@ -0,0 +1,756 @@
+#define _DEFAULT_SOURCE /* for mmap and madvise */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <string.h>
+
+#include "memory.h"
+#include "fail.h"
+#include "engine.h"
+#include "statistics.h"
+#include "heap_profiler.h"
+
+/* Generational garbage collector.
+ *
+ * The heap is composed of an old generation followed by a nursery.
+ * Blocks are allocated in the nursery by bumping a pointer. When it is
+ * full, a minor collection copies its live blocks to the old generation
+ * using Cheney's algorithm, and empties it. Blocks too big for the
+ * nursery are allocated directly in the old generation, which is
+ * collected by mark & sweep (a major collection) when it cannot hold
+ * the blocks promoted by a minor collection. A major collection marks
+ * the blocks reachable from the register frames, through the nursery,
+ * whose blocks are only freed by the next minor collection.
+ *
+ * The roots of a minor collection are the register frames, and the
+ * fields of old blocks which may point to the nursery. These are found
+ * using the card table, in which BSET marks the card of the field it
+ * writes, and the list of register frames promoted to the old
+ * generation: their registers are written without write barrier, so
+ * they are scanned by every minor collection.
+ *
+ * As in the other memory modules, a value whose two low bits are 0 and
+ * which points to the start of a block is considered to be a pointer to
+ * that block. When the block is promoted, the value is updated.
+ */
+
+#define HEADER_SIZE 1
+
+/* Size of the nursery, as a fraction of the heap */
+#define NURSERY_FRACTION 8
+
+/* Blocks bigger than this fraction of the nursery are allocated
+   directly in the old generation */
+#define LARGE_BLOCK_FRACTION 4
+
+/* Number of free lists of the old generation. List i < OLD_FREE_LISTS-1
+   contains free blocks whose body has i+1 words, the last one the
+   bigger ones. */
+#define OLD_FREE_LISTS 32
+
+static uvalue_t* memory_start = NULL;
+static uvalue_t* memory_end = NULL;
+static bool huge_pages = false;
+
+static uint8_t* card_table = NULL;
+static size_t card_count = 0;
+
+static uvalue_t* old_start = NULL;
+static uvalue_t* old_end = NULL;
+static uvalue_t* old_starts = NULL;   /* bitmap of allocated old blocks */
+static uvalue_t* old_marks = NULL;    /* bitmap of marked old blocks */
+static uvalue_t* free_lists[OLD_FREE_LISTS];
+
+/* Area of the old generation in which blocks are allocated by bumping
+   a pointer, i.e. the biggest free block found by the last sweep */
+static uvalue_t* promotion_top = NULL;
+static uvalue_t* promotion_end = NULL;
+
+static uvalue_t* nursery_start = NULL;
+static uvalue_t* nursery_top = NULL;
+static uvalue_t* nursery_end = NULL;
+static uvalue_t* nursery_starts = NULL; /* bitmap of nursery blocks */
+static uvalue_t* nursery_marks = NULL;  /* bitmap of marked nursery blocks */
+static size_t large_block_words = 0;
+
+/* Allocation buffer, i.e. the free part of the nursery when it was
+   refilled. The blocks allocated in it since buffer_start are only set
+   in nursery_starts, and nursery_top is only updated, when it is
+   retired. Large blocks which fit in it are allocated in the nursery. */
+static memory_buffer_t buffer = { NULL, NULL };
+static uvalue_t* buffer_start = NULL;
+
+/* Statistics, recorded only when enabled */
+static bool record_statistics = false;
+static size_t old_live_words = 0; /* after the last sweep */
+
+/******************** Utils functions ****************************/
+
+static void* addr_v_to_p(uvalue_t v_addr) {
+  return (char*)memory_start + v_addr;
+}
+
+static uvalue_t addr_p_to_v(uvalue_t* p_addr) {
+  assert(memory_start <= p_addr && p_addr <= memory_end);
+  return (uvalue_t)((char*)p_addr - (char*)memory_start);
+}
+
+static uvalue_t header_pack(tag_t tag, uvalue_t size) {
+  return (size << 8) | (uvalue_t)tag;
+}
+
+static tag_t header_unpack_tag(uvalue_t header) {
+  return (tag_t)(header & 0xFF);
+}
+
+static uvalue_t header_unpack_size(uvalue_t header) {
+  return header >> 8;
+}
+
+/* Number of words occupied by an allocated block, header included.
+   Blocks of size 0 have one word of body, which holds the forwarding
+   address of promoted blocks and the link of free blocks. */
+static size_t block_words(uvalue_t size) {
+  return HEADER_SIZE + (size == 0 ? 1 : size);
+}
+
+/* Number of words occupied by a free block of the old generation, or by
+   a one-word filler (a free block of size 0) */
+static size_t free_block_words(const uvalue_t* block) {
+  return HEADER_SIZE + header_unpack_size(*block);
+}
+
+/******************** Bitmaps ****************************/
+
+static size_t bitmap_words(size_t bits) {
+  return (bits + VALUE_BITS - 1) / VALUE_BITS;
+}
+
+static uvalue_t* bitmap_allocate(size_t bits) {
+  uvalue_t* bitmap = calloc(bitmap_words(bits), sizeof(uvalue_t));
+  if (bitmap == NULL)
+    fail("cannot allocate memory for the garbage collector");
+  return bitmap;
+}
+
+static bool bit_get(const uvalue_t* bitmap, size_t i) {
+  return (bitmap[i / VALUE_BITS] >> (i % VALUE_BITS)) & 1u;
+}
+
+static void bit_set(uvalue_t* bitmap, size_t i) {
+  bitmap[i / VALUE_BITS] |= 1u << (i % VALUE_BITS);
+}
+
+static void bit_clear(uvalue_t* bitmap, size_t i) {
+  bitmap[i / VALUE_BITS] &= ~(1u << (i % VALUE_BITS));
+}
+
+/* Return the index of the last set bit at or before i, or SIZE_MAX */
+static size_t bit_find_prev(const uvalue_t* bitmap, size_t i) {
+  size_t w = i / VALUE_BITS;
+  uvalue_t word = bitmap[w] & (UINT32_MAX >> (VALUE_BITS - 1 - i % VALUE_BITS));
+  while (word == 0) {
+    if (w == 0)
+      return SIZE_MAX;
+    word = bitmap[--w];
+  }
+  return w * VALUE_BITS + (VALUE_BITS - 1 - (size_t)__builtin_clz(word));
+}
+
+/* Return the index of the first set bit at or after i and before end,
+   or end */
+static size_t bit_find_next(const uvalue_t* bitmap, size_t i, size_t end) {
+  if (i >= end)
+    return end;
+  size_t w = i / VALUE_BITS;
+  uvalue_t word = bitmap[w] & (UINT32_MAX << (i % VALUE_BITS));
+  while (word == 0) {
+    if (++w * VALUE_BITS >= end)
+      return end;
+    word = bitmap[w];
+  }
+  size_t index = w * VALUE_BITS + (size_t)__builtin_ctz(word);
+  return index < end ? index : end;
+}
+
+/******************** Block stacks ****************************/
+
+typedef struct {
+  uvalue_t** elems;
+  size_t size;
+  size_t capacity;
+} block_stack_t;
+
+static block_stack_t old_frames;     /* register frames promoted */
+static block_stack_t mark_stack;
+static block_stack_t areas;          /* promotion areas, by pairs */
+
+static void block_stack_push(block_stack_t* stack, uvalue_t* block) {
+  if (stack->size == stack->capacity) {
+    stack->capacity = stack->capacity == 0 ? 256 : 2 * stack->capacity;
+    stack->elems = realloc(stack->elems, stack->capacity * sizeof(uvalue_t*));
+    if (stack->elems == NULL)
+      fail("cannot allocate memory for the garbage collector");
+  }
+  stack->elems[stack->size++] = block;
+}
+
+static void block_stack_free(block_stack_t* stack) {
+  free(stack->elems);
+  memset(stack, 0, sizeof(*stack));
+}
+
+/******************** Old generation ****************************/
+
+static bool is_old_block(uvalue_t v_addr) {
+  if ((v_addr & 0x03u) != 0
+      || v_addr < addr_p_to_v(old_start) + HEADER_SIZE * sizeof(uvalue_t)
+      || v_addr >= addr_p_to_v(old_end))
+    return false;
+  uvalue_t* block = (uvalue_t*)addr_v_to_p(v_addr) - HEADER_SIZE;
+  return bit_get(old_starts, (size_t)(block - old_start));
+}
+
+static size_t free_list_index(size_t body_words) {
+  return body_words <= OLD_FREE_LISTS - 1 ? body_words - 1 : OLD_FREE_LISTS - 1;
+}
+
+/* Turn the given range of the old generation into a free block, and
+   add it to the free lists unless it is a one-word filler */
+static void old_free_range(uvalue_t* start, uvalue_t* end) {
+  if (start == end)
+    return;
+  size_t body_words = (size_t)(end - start) - HEADER_SIZE;
+  *start = header_pack(tag_None, (uvalue_t)body_words);
+  if (body_words > 0) {
+    size_t index = free_list_index(body_words);
+    start[HEADER_SIZE] =
+      free_lists[index] == NULL ? 0 : addr_p_to_v(free_lists[index]);
+    free_lists[index] = start;
+  }
+}
+
+static uvalue_t* free_list_next(const uvalue_t* block) {
+  uvalue_t next = block[HEADER_SIZE];
+  return next == 0 ? NULL : addr_v_to_p(next);
+}
+
+/* Remove a free block of at least the given number of words from the
+   free lists, and return it, or NULL if there is none. */
+static uvalue_t* old_take_free_block(size_t words) {
+  size_t body_words = words - HEADER_SIZE;
+  for (size_t i = free_list_index(body_words); i < OLD_FREE_LISTS - 1; ++i) {
+    uvalue_t* block = free_lists[i];
+    if (block != NULL) {
+      free_lists[i] = free_list_next(block);
+      return block;
+    }
+  }
+
+  uvalue_t* prev = NULL;
+  for (uvalue_t* block = free_lists[OLD_FREE_LISTS - 1];
+       block != NULL;
+       prev = block, block = free_list_next(block)) {
+    if (free_block_words(block) >= words) {
+      if (prev == NULL)
+        free_lists[OLD_FREE_LISTS - 1] = free_list_next(block);
+      else
+        prev[HEADER_SIZE] = block[HEADER_SIZE];
+      return block;
+    }
+  }
+  return NULL;
+}
+
+/* Allocate the given number of words in the promotion area, switching
+   to a new area if needed. Return NULL if the old generation is full. */
+static uvalue_t* old_allocate_words(size_t words) {
+  if ((size_t)(promotion_end - promotion_top) < words) {
+    uvalue_t* block = old_take_free_block(words);
+    if (block == NULL)
+      return NULL;
+    if (areas.size > 0) {
+      /* A minor collection is in progress, the new area must also be
+         scanned */
+      areas.elems[areas.size - 1] = promotion_top;
+      block_stack_push(&areas, block);
+      block_stack_push(&areas, block);
+    }
+    old_free_range(promotion_top, promotion_end);
+    promotion_top = block;
+    promotion_end = block + free_block_words(block);
+  }
+  uvalue_t* block = promotion_top;
+  promotion_top += words;
+  bit_set(old_starts, (size_t)(block - old_start));
+  return block;
+}
+
+/******************** Major collection ****************************/
+
+static bool is_nursery_block(uvalue_t v_addr) {
+  if ((v_addr & 0x03u) != 0
+      || v_addr < addr_p_to_v(nursery_start) + HEADER_SIZE * sizeof(uvalue_t)
+      || v_addr >= addr_p_to_v(nursery_top))
+    return false;
+  uvalue_t* block = (uvalue_t*)addr_v_to_p(v_addr) - HEADER_SIZE;
+  return bit_get(nursery_starts, (size_t)(block - nursery_start));
+}
+
+static void mark_value(uvalue_t value) {
+  if (is_old_block(value)) {
+    uvalue_t* block = (uvalue_t*)addr_v_to_p(value) - HEADER_SIZE;
+    size_t index = (size_t)(block - old_start);
+    if (!bit_get(old_marks, index)) {
+      bit_set(old_marks, index);
+      block_stack_push(&mark_stack, block);
+    }
+  } else if (is_nursery_block(value)) {
+    uvalue_t* block = (uvalue_t*)addr_v_to_p(value) - HEADER_SIZE;
+    size_t index = (size_t)(block - nursery_start);
+    if (!bit_get(nursery_marks, index)) {
+      bit_set(nursery_marks, index);
+      block_stack_push(&mark_stack, block);
+    }
+  }
+}
+
+static void mark_range(const uvalue_t* start, const uvalue_t* end) {
+  for (const uvalue_t* field = start; field < end; ++field)
+    mark_value(*field);
+}
+
+static void mark_drain(void) {
+  while (mark_stack.size > 0) {
+    uvalue_t* block = mark_stack.elems[--mark_stack.size];
+    uvalue_t* body = block + HEADER_SIZE;
+    mark_range(body, body + header_unpack_size(*block));
+  }
+}
+
+/* Sweep the old generation, coalescing adjacent free blocks. The
+   biggest free block becomes the promotion area, the others are added
+   to the free lists. */
+static void sweep(void) {
+  memset(free_lists, 0, sizeof(free_lists));
+  promotion_top = promotion_end = old_start;
+  old_live_words = 0;
+
+  uvalue_t* free_start = NULL;
+  uvalue_t* curr = old_start;
+  while (curr < old_end) {
+    size_t index = (size_t)(curr - old_start);
+    size_t words;
+    bool is_free;
+    if (bit_get(old_starts, index)) {
+      words = block_words(header_unpack_size(*curr));
+      is_free = !bit_get(old_marks, index);
+      bit_clear(old_marks, index);
+      if (is_free)
+        bit_clear(old_starts, index);
+      else
+        old_live_words += words;
+    } else {
+      assert(header_unpack_tag(*curr) == tag_None);
+      words = free_block_words(curr);
+      is_free = true;
+    }
+
+    if (is_free && free_start == NULL)
+      free_start = curr;
+    curr += words;
+    if (free_start != NULL && (!is_free || curr >= old_end)) {
+      uvalue_t* free_end = is_free ? curr : curr - words;
+      if (free_end - free_start > promotion_end - promotion_top) {
+        old_free_range(promotion_top, promotion_end);
+        promotion_top = free_start;
+        promotion_end = free_end;
+      } else
+        old_free_range(free_start, free_end);
+      free_start = NULL;
+    }
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < old_frames.size; ++i) {
+    uvalue_t* frame = old_frames.elems[i];
+    if (bit_get(old_starts, (size_t)(frame - old_start)))
+      old_frames.elems[kept++] = frame;
+  }
+  old_frames.size = kept;
+}
+
+/* Record the state of the old generation and the lengths of its free
+   lists after a sweep. Its biggest free block is the promotion area. */
+static void record_old_statistics(void) {
+  for (size_t i = 0; i < OLD_FREE_LISTS; ++i) {
+    size_t length = 0;
+    for (uvalue_t* block = free_lists[i];
+         block != NULL;
+         block = free_list_next(block))
+      ++length;
+    if (length > 0)
+      statistics_record_free_list(i, i + 1, length);
+  }
+  size_t old_words = (size_t)(old_end - old_start);
+  statistics_record_heap(old_live_words,
+                         old_words,
+                         old_words - old_live_words,
+                         (size_t)(promotion_end - promotion_top));
+}
+
+static void buffer_retire(void) {
+  if (record_statistics)
+    statistics_record_blocks(buffer_start, buffer.top);
+  for (uvalue_t* block = buffer_start;
+       block < buffer.top;
+       block += block_words(header_unpack_size(*block)))
+    bit_set(nursery_starts, (size_t)(block - nursery_start));
+  if (buffer.top != NULL)
+    nursery_top = buffer.top;
+  buffer.top = buffer.end = buffer_start = NULL;
+}
+
+/* Return the given block, given by its body as for the heap profiler,
+   if it survived the major collection, or NULL if it is dead. Dead
+   blocks of the nursery are only freed by the next minor collection,
+   but are not reachable anymore. */
+static uvalue_t* major_survivor(uvalue_t* body) {
+  uvalue_t* block = body - HEADER_SIZE;
+  if (block >= nursery_start)
+    return bit_get(nursery_marks, (size_t)(block - nursery_start)) ? body : NULL;
+  return bit_get(old_marks, (size_t)(block - old_start)) ? body : NULL;
+}
+
+static void collect_major(void) {
+  buffer_retire();
+  old_free_range(promotion_top, promotion_end);
+  promotion_top = promotion_end = NULL;
+  uint64_t start_time = record_statistics ? statistics_clock() : 0;
+
+  uvalue_t* bases[] = { engine_get_Ib(), engine_get_Lb(), engine_get_Ob() };
+  for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); ++i)
+    mark_value(addr_p_to_v(bases[i]));
+  mark_range(engine_get_frames_start(), engine_get_frames_top());
+  mark_drain();
+  if (heap_profiler_is_running())
+    heap_profiler_census(major_survivor);
+  memset(nursery_marks, 0,
+         bitmap_words((size_t)(nursery_top - nursery_start)) * sizeof(uvalue_t));
+
+  if (record_statistics) {
+    uint64_t marked_time = statistics_clock();
+    statistics_record_phase(statistics_mark, marked_time - start_time);
+    sweep();
+    statistics_record_phase(statistics_sweep, statistics_clock() - marked_time);
+    record_old_statistics();
+  } else
+    sweep();
+}
+
+/******************** Minor collection ****************************/
+
+/* Copy the given nursery block to the old generation, unless it was
+   already copied, and return its copy. A copied block is replaced by a
+   free block whose body holds the address of the copy. */
+static uvalue_t* promote(uvalue_t* block) {
+  if (header_unpack_tag(*block) == tag_None)
+    return addr_v_to_p(block[HEADER_SIZE]);
+
+  size_t words = block_words(header_unpack_size(*block));
+  uvalue_t* copy = old_allocate_words(words);
+  if (copy == NULL)
+    fail("no memory left in the old generation");
+  memcpy(copy, block, words * sizeof(uvalue_t));
+  if (header_unpack_tag(*block) == tag_RegisterFrame)
+    block_stack_push(&old_frames, copy);
+
+  *block = header_pack(tag_None, 0);
+  block[HEADER_SIZE] = addr_p_to_v(copy);
+  return copy;
+}
+
+static void forward_field(uvalue_t* field) {
+  if (is_nursery_block(*field)) {
+    uvalue_t* block = (uvalue_t*)addr_v_to_p(*field) - HEADER_SIZE;
+    *field = addr_p_to_v(promote(block) + HEADER_SIZE);
+  }
+}
+
+static void forward_range(uvalue_t* start, uvalue_t* end) {
+  for (uvalue_t* field = start; field < end; ++field)
+    forward_field(field);
+}
+
+static uvalue_t* forward_base(uvalue_t* base) {
+  uvalue_t v_base = addr_p_to_v(base);
+  forward_field(&v_base);
+  return addr_v_to_p(v_base);
+}
+
+/* Forward the fields of the old blocks located in the dirty cards,
+   and clean the cards */
+static void forward_dirty_cards(void) {
+  size_t old_words = (size_t)(old_end - old_start);
+  size_t first_card = addr_p_to_v(old_start) >> MEMORY_CARD_BITS;
+  size_t last_card = (addr_p_to_v(old_end) - 1) >> MEMORY_CARD_BITS;
+  for (size_t card = first_card; card <= last_card; ++card) {
+    if (card_table[card] == 0)
+      continue;
+    card_table[card] = 0;
+
+    uvalue_t* card_start = addr_v_to_p((uvalue_t)(card << MEMORY_CARD_BITS));
+    uvalue_t* card_end =
+      addr_v_to_p((uvalue_t)((card + 1) << MEMORY_CARD_BITS));
+    if (card_start < old_start)
+      card_start = old_start;
+    if (card_end > old_end)
+      card_end = old_end;
+
+    size_t index = bit_find_prev(old_starts,
+                                 (size_t)(card_start - old_start));
+    if (index == SIZE_MAX)
+      index = bit_find_next(old_starts, 0, old_words);
+    while (index < old_words && old_start + index < card_end) {
+      uvalue_t* block = old_start + index;
+      uvalue_t* body = block + HEADER_SIZE;
+      uvalue_t* start = body > card_start ? body : card_start;
+      uvalue_t* end = body + header_unpack_size(*block);
+      forward_range(start, end < card_end ? end : card_end);
+      index = bit_find_next(old_starts,
+                            index + block_words(header_unpack_size(*block)),
+                            old_words);
+    }
+  }
+}
+
+/* Forward the fields of the promoted blocks, in the order in which they
+   were copied (Cheney's algorithm). Blocks are copied to a sequence of
+   promotion areas, recorded by pairs of start and end addresses (the
+   end of the last one being the promotion top). */
+static void forward_promoted(void) {
+  size_t area = 0;
+  uvalue_t* scan = areas.elems[0];
+  for (;;) {
+    uvalue_t* area_end = area + 2 == areas.size
+      ? promotion_top
+      : areas.elems[area + 1];
+    if (scan < area_end) {
+      uvalue_t* body = scan + HEADER_SIZE;
+      forward_range(body, body + header_unpack_size(*scan));
+      scan += block_words(header_unpack_size(*scan));
+    } else if (area + 2 < areas.size) {
+      area += 2;
+      scan = areas.elems[area];
+    } else
+      break;
+  }
+}
+
+/* Return the copy of the given block, given by its body as for the heap
+   profiler, if it was promoted by the minor collection, or NULL if it is
+   dead. Blocks of the old generation are not collected. */
+static uvalue_t* minor_survivor(uvalue_t* body) {
+  uvalue_t* block = body - HEADER_SIZE;
+  if (block < nursery_start)
+    return body;
+  if (header_unpack_tag(*block) != tag_None)
+    return NULL;
+  return (uvalue_t*)addr_v_to_p(block[HEADER_SIZE]) + HEADER_SIZE;
+}
+
+static void collect_minor(void) {
+  buffer_retire();
+  if ((size_t)(promotion_end - promotion_top)
+      < (size_t)(nursery_top - nursery_start))
+    collect_major();
+  uint64_t start_time = record_statistics ? statistics_clock() : 0;
+
+  block_stack_push(&areas, promotion_top);
+  block_stack_push(&areas, promotion_top);
+
+  engine_set_Ib(forward_base(engine_get_Ib()));
+  engine_set_Lb(forward_base(engine_get_Lb()));
+  engine_set_Ob(forward_base(engine_get_Ob()));
+  forward_range(engine_get_frames_start(), engine_get_frames_top());
+  for (size_t i = 0; i < old_frames.size; ++i) {
+    uvalue_t* frame = old_frames.elems[i] + HEADER_SIZE;
+    forward_range(frame, frame + header_unpack_size(frame[-1]));
+  }
+  forward_dirty_cards();
+  forward_promoted();
+  areas.size = 0;
+  if (heap_profiler_is_running())
+    heap_profiler_census(minor_survivor);
+
+  size_t nursery_words = (size_t)(nursery_end - nursery_start);
+  memset(nursery_starts, 0, bitmap_words(nursery_words) * sizeof(uvalue_t));
+  memset(card_table + (addr_p_to_v(nursery_start) >> MEMORY_CARD_BITS),
+         0,
+         card_count - (addr_p_to_v(nursery_start) >> MEMORY_CARD_BITS));
+  nursery_top = nursery_start;
+  if (record_statistics)
+    statistics_record_phase(statistics_minor, statistics_clock() - start_time);
+}
+
+/******************** Memory Management ****************************/
+
+char* memory_get_identity() {
+  return "GC: Generational (copying nursery, mark and sweep old generation)";
+}
+
+void memory_setup(size_t total_byte_size) {
+  record_statistics = statistics_are_enabled();
+  // The memory is zero-filled and only backed once touched
+  void* memory = mmap(NULL, total_byte_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED)
+    fail("cannot allocate %zd bytes of memory", total_byte_size);
+#ifdef MADV_HUGEPAGE
+  if (huge_pages)
+    madvise(memory, total_byte_size, MADV_HUGEPAGE);
+#endif
+  memory_start = memory;
+  memory_end = memory_start + (total_byte_size / sizeof(value_t));
+
+  card_count = (total_byte_size >> MEMORY_CARD_BITS) + 1;
+  card_table = calloc(card_count, 1);
+  if (card_table == NULL)
+    fail("cannot allocate memory for the card table");
+}
+
+void memory_set_heap_limits(size_t min_size,
+                            size_t max_size,
+                            unsigned int target) {
+  if (min_size != 0 || max_size != 0 || target != 0)
+    fail("the heap size cannot be adapted by this memory system");
+}
+
+void memory_set_compact_always(bool always) {
+  if (always)
+    fail("the heap cannot be compacted by this memory system");
+}
+
+void memory_set_gc_threads(unsigned int count) {
+  if (count != 1)
+    fail("this memory system cannot use several threads");
+}
+
+void memory_set_huge_pages(bool huge) {
+  assert(memory_start == NULL);
+  huge_pages = huge;
+}
+
+void memory_cleanup() {
+  assert(memory_start != NULL);
+  if (record_statistics)
+    statistics_record_blocks(buffer_start, buffer.top);
+  block_stack_free(&old_frames);
+  block_stack_free(&mark_stack);
+  block_stack_free(&areas);
+  free(nursery_starts);
+  free(nursery_marks);
+  free(old_marks);
+  free(old_starts);
+  free(card_table);
+  munmap(memory_start, (size_t)((char*)memory_end - (char*)memory_start));
+  memory_start = memory_end = NULL;
+  old_start = old_end = old_starts = old_marks = NULL;
+  nursery_start = nursery_top = nursery_end = NULL;
+  nursery_starts = nursery_marks = NULL;
+  promotion_top = promotion_end = NULL;
+  buffer.top = buffer.end = buffer_start = NULL;
+  card_table = NULL;
+  record_statistics = false;
+  old_live_words = 0;
+}
+
+void* memory_get_start() {
+  return memory_start;
+}
+
+void* memory_get_end() {
+  return memory_end;
+}
+
+uint8_t* memory_get_card_table() {
+  return card_table;
+}
+
+void memory_set_heap_start(void* heap_start) {
+  assert(old_start == NULL);
+  size_t heap_words = (size_t)(memory_end - (uvalue_t*)heap_start);
+  size_t nursery_words = heap_words / NURSERY_FRACTION;
+  if (nursery_words < 64)
+    fail("heap too small (%zd words)", heap_words);
+
+  old_start = heap_start;
+  old_end = nursery_start = nursery_top = memory_end - nursery_words;
+  nursery_end = memory_end;
+  large_block_words = nursery_words / LARGE_BLOCK_FRACTION;
+
+  size_t old_words = (size_t)(old_end - old_start);
+  old_starts = bitmap_allocate(old_words);
+  old_marks = bitmap_allocate(old_words);
+  nursery_starts = bitmap_allocate(nursery_words);
+  nursery_marks = bitmap_allocate(nursery_words);
+  memset(free_lists, 0, sizeof(free_lists));
+  promotion_top = old_start;
+  promotion_end = old_end;
+}
+
+static uvalue_t* old_allocate(uvalue_t size) {
+  size_t words = block_words(size);
+  uvalue_t* block = old_allocate_words(words);
+  if (block == NULL) {
+    collect_major();
+    block = old_allocate_words(words);
+    if (block == NULL)
+      fail("no memory left (block of size %u requested)", size);
+  }
+  return block;
+}
+
+uvalue_t* memory_allocate(tag_t tag, uvalue_t size) {
+  assert(nursery_start != NULL);
+
+  if (block_words(size) <= large_block_words)
+    return memory_buffer_allocate(&buffer, tag, size);
+
+  uvalue_t* block = old_allocate(size);
+  if (tag == tag_RegisterFrame)
+    block_stack_push(&old_frames, block);
+  *block = header_pack(tag, size);
+  if (record_statistics)
+    statistics_record_block(tag, size);
+  return block + HEADER_SIZE;
+}
+
+memory_buffer_t* memory_get_buffer() {
+  return &buffer;
+}
+
+uvalue_t* memory_buffer_refill(tag_t tag, uvalue_t size) {
+  buffer_retire();
+  size_t words = block_words(size);
+  if (words > large_block_words)
+    return memory_allocate(tag, size);
+
+  if ((size_t)(nursery_end - nursery_top) < words)
+    collect_minor();
+  buffer.top = buffer_start = nursery_top;
+  buffer.end = nursery_end;
+  return memory_buffer_allocate(&buffer, tag, size);
+}
+
+uvalue_t memory_get_block_size(uvalue_t* block) {
+  return header_unpack_size(block[-1]);
+}
+
+tag_t memory_get_block_tag(uvalue_t* block) {
+  return header_unpack_tag(block[-1]);
+}
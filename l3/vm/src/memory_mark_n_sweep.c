@@ -1,21 +1,111 @@
+#define _DEFAULT_SOURCE /* for mmap, madvise and sysconf */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "memory.h"
 #include "mark_n_sweep.h"
 #include "fail.h"
 #include "engine.h"
+#include "statistics.h"
+#include "heap_profiler.h"
 
 static uvalue_t* memory_start = NULL;
-static uvalue_t* memory_end = NULL;
+static uvalue_t* memory_end = NULL;      /* end of the heap */
+static uvalue_t* heap_limit = NULL;      /* end of the allocated part */
+static uvalue_t* memory_reserved_end = NULL;
+static size_t page_size = 0;
+static bool huge_pages = false;
+
+/* Sizing policy of the heap, in words once the heap is set up. After
+   each collection, the heap grows if more than heap_target percent of
+   it is live, and shrinks if less than half of that is live after
+   HEAP_SHRINK_COLLECTIONS collections in a row: blocks are then only
+   allocated before the heap limit, and the heap is truncated once all
+   the blocks after it are dead. */
+static size_t heap_min_size = 0;
+static size_t heap_max_size = 0;
+static unsigned int heap_target = HEAP_TARGET_DEFAULT;
+static unsigned int heap_low_collections = 0;
 
 static uvalue_t* bitmap_start = NULL;
 static uvalue_t* heap_start = NULL;
 
-static seg_list free_lists[NB_FREE_LISTS];
+/* Bitmap of the marked blocks, which is empty outside of collections
+   and of the part of the heap which has not been swept yet. Both
+   bitmaps have one bit per word of the heap, in bitmap_rows words. */
+static uvalue_t* mark_bitmap_start = NULL;
+static size_t bitmap_rows = 0;
+
+/* First row of the bitmaps which has not been swept yet since the last
+   collection, and start of the free run which ends after it */
+static size_t sweep_row = 0;
+static uvalue_t* sweep_free_start = NULL;
+static size_t sweep_live_words = 0;
+
+/* Background sweeper, which only runs with several threads. The lock
+   protects the sweep state and the free lists while the heap is not
+   completely swept. */
+static pthread_t sweeper;
+static pthread_mutex_t sweep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sweep_started = PTHREAD_COND_INITIALIZER;
+static bool sweeper_running = false;
+static bool sweeper_stopping = false;
+
+/* Compaction, which only runs when the free memory is too fragmented
+   for an allocation, unless compact_always is set. The forwarding table
+   has one entry per row of the bitmaps. After a compaction, the memory
+   after the last block is the allocation buffer. */
+static bool compact_always = false;
+static uvalue_t* compact_table = NULL;
+static size_t compact_table_rows = 0;
+
+/* Allocation buffer, taken from the free lists, whose blocks are only
+   set in the bitmap when it is retired. The ones before buffer_start
+   are already set. */
+static memory_buffer_t buffer = { NULL, NULL };
+static uvalue_t* buffer_start = NULL;
+
+static void buffer_retire(void);
+
+/* Large-object space, at the end of the reserved memory, in which
+   blocks of at least LARGE_BLOCK_SIZE words are allocated in pages of
+   their own. These are never moved, and given back to the system once
+   dead. The table of large objects is sorted by address. */
+typedef struct {
+  uvalue_t* block;
+  size_t words;                 /* a multiple of the page size */
+  bool marked;
+} large_object_t;
+
+static uvalue_t* large_start = NULL;
+static uvalue_t* large_end = NULL;
+static large_object_t* large_objects = NULL;
+static size_t large_count = 0;
+static size_t large_capacity = 0;
+static size_t large_allocated_words = 0; /* since the last collection */
+static size_t large_live_words = 0;      /* after the last collection */
+
+/* Two-level segregated fit free lists. Free blocks are classified
+   first by the position of the most significant bit of their size, and
+   then by its next FREE_LISTS_SL_BITS bits (small sizes have one list
+   each). A bitmap of the non-empty lists of each level gives the first
+   list that can contain a block of some size in constant time. */
+static uvalue_t* free_lists[FREE_LISTS_FL_COUNT][FREE_LISTS_SL_COUNT];
+static uvalue_t free_lists_sl_bitmaps[FREE_LISTS_FL_COUNT];
+static uvalue_t free_lists_fl_bitmap;
+
+/* Statistics, recorded only when enabled. The time spent sweeping is
+   summed over the steps of a sweep. */
+static bool record_statistics = false;
+static uint64_t sweep_nanoseconds = 0;
 
 /******************** Utils functions ****************************/
 static void* addr_v_to_p(const uvalue_t v_addr) {
@@ -55,171 +145,122 @@ bool is_valid_size_block(const uvalue_t block, const uvalue_t size) {
   return header_unpack_size(block) > size + HEADER_SIZE;
 }
 
-bool is_best_fit(const uvalue_t* current_best, const uvalue_t* candidate, const uvalue_t requested_size) {
-  if (candidate == NULL) {
-    return false;
-  }
-
-  if (current_best == NULL) {
-    return candidate != NULL && is_valid_size_block(*candidate, requested_size);
-  }
+/******************** Free lists management ****************************/
 
-  uvalue_t current_best_size = header_unpack_size(*current_best);
-  uvalue_t new_size = header_unpack_size(*candidate);
-  return new_size < current_best_size && is_valid_size_block(*candidate, requested_size);
+static unsigned int log2_floor(const uvalue_t size) {
+  assert(size != 0);
+  return (unsigned int)(VALUE_BITS - 1) - (unsigned int)__builtin_clz(size);
 }
 
-/******************** Free lists management ****************************/
-
-void reset_free_lists() {
-  for (int i=0; i < NB_FREE_LISTS; i++) {
-    free_lists[i].first = NULL;
-    free_lists[i].last = NULL;
+void free_list_index(const uvalue_t size, unsigned int* fl, unsigned int* sl) {
+  assert(size >= 1 && size <= MAX_BLOCK_SIZE);
+  if (size < FREE_LISTS_SL_COUNT) {
+    *fl = 0;
+    *sl = size;
+  } else {
+    unsigned int log2 = log2_floor(size);
+    *fl = log2 - FREE_LISTS_SL_BITS + 1;
+    *sl = (size >> (log2 - FREE_LISTS_SL_BITS)) - FREE_LISTS_SL_COUNT;
   }
+  assert(*fl < FREE_LISTS_FL_COUNT && *sl < FREE_LISTS_SL_COUNT);
 }
 
-void remove_first_from_free_list(const uvalue_t index) {
-  uvalue_t* free_block = free_lists[index].first;
-  if (free_block != NULL) {
-    if (free_lists[index].first == free_lists[index].last) {
-      free_lists[index].first = NULL;
-      free_lists[index].last = NULL;
-    } else {
-      uvalue_t next_virtual = *(free_block + HEADER_SIZE);
-      free_lists[index].first = next_virtual == NULL ? NULL : addr_v_to_p(next_virtual);
-    }
-  }
+void reset_free_lists() {
+  memset(free_lists, 0, sizeof(free_lists));
+  memset(free_lists_sl_bitmaps, 0, sizeof(free_lists_sl_bitmaps));
+  free_lists_fl_bitmap = 0;
 }
 
 void add_to_free_list(uvalue_t* block) {
-  uvalue_t block_size = header_unpack_size(*block);
-  size_t index = MIN(NB_FREE_LISTS-1, block_size-1);
-  assert(0 <= index && index < NB_FREE_LISTS);
-  seg_list free_list = free_lists[index];
-  if (free_list.last == NULL) {
-    free_lists[index].last = block;
-    free_lists[index].first = block;
-  } else {
-    *(free_list.last + HEADER_SIZE) = addr_p_to_v(block);
-    free_lists[index].last = block;
-  }
-  *(block + HEADER_SIZE) = NULL;
+  unsigned int fl, sl;
+  free_list_index(header_unpack_size(*block), &fl, &sl);
+  uvalue_t* first = free_lists[fl][sl];
+  *(block + HEADER_SIZE) = first == NULL ? 0 : addr_p_to_v(first);
+  free_lists[fl][sl] = block;
+  free_lists_sl_bitmaps[fl] |= 1u << sl;
+  free_lists_fl_bitmap |= 1u << fl;
 }
 
-uvalue_t* find_best_free_block(const uvalue_t size) {
-  // Best fit pointers
-  uvalue_t* curr_best = NULL;
-  uvalue_t* prev_best = NULL;
-
-  // Pointer to traverse the free list
-  uvalue_t* prev = NULL;
-  uvalue_t* curr = free_lists[NB_FREE_LISTS-1].first;
-
-  while (curr != NULL && header_unpack_size(*curr) != size) {
-    if (is_best_fit(curr_best, curr, size)) {
-      curr_best = curr;
-      prev_best = prev;
-    }
-
-    // Update pointers
-    uvalue_t next_virtual = *(curr + HEADER_SIZE);
-    prev = curr;
-    curr = next_virtual == NULL ? NULL : addr_v_to_p(next_virtual);
+/* Remove the first block of the given free list, which is not empty */
+static uvalue_t* remove_first_from_free_list(const unsigned int fl,
+                                             const unsigned int sl) {
+  uvalue_t* block = free_lists[fl][sl];
+  assert(block != NULL);
+  uvalue_t next_virtual = *(block + HEADER_SIZE);
+  free_lists[fl][sl] = next_virtual == 0 ? NULL : addr_v_to_p(next_virtual);
+  if (free_lists[fl][sl] == NULL) {
+    free_lists_sl_bitmaps[fl] &= ~(1u << sl);
+    if (free_lists_sl_bitmaps[fl] == 0)
+      free_lists_fl_bitmap &= ~(1u << fl);
   }
+  return block;
+}
 
-  // In case first pointer has the exact size
-  if (curr != NULL && header_unpack_size(*curr) == size) {
-    curr_best = curr;
-    prev_best = prev;
+uvalue_t* find_free_block(const uvalue_t size) {
+  unsigned int fl, sl;
+
+  // Small sizes have their own free list, which contains exact fits
+  if (size < FREE_LISTS_SL_COUNT && free_lists[0][size] != NULL) {
+    return remove_first_from_free_list(0, size);
   }
 
-  // No match found
-  if (curr_best == NULL) {
+  // Otherwise, all the blocks of the first non-empty list whose sizes
+  // are all bigger than size + HEADER_SIZE can be split
+  const uvalue_t min_size = size + HEADER_SIZE + 1;
+  if (min_size > MAX_BLOCK_SIZE) {
     return NULL;
   }
-
-  const uvalue_t block_size = header_unpack_size(*curr_best);
-  uvalue_t best_next_addr = *(curr_best + HEADER_SIZE);
-
-  // Check if split is needed
-  if (block_size != size) {
-    uvalue_t* phy_addr = curr_best + size + HEADER_SIZE;
-    uvalue_t new_size = block_size - size - HEADER_SIZE;
-    assert(new_size >= 1);
-    *phy_addr = header_pack(tag_None, new_size);
-
-    // Update correct free list or update the last free list
-    if (new_size < NB_FREE_LISTS) {
-      add_to_free_list(phy_addr);
-    } else {
-      // Update next pointer of the last free list
-      *(phy_addr + HEADER_SIZE) = best_next_addr;
-      best_next_addr = addr_p_to_v(phy_addr);
-    }
+  uvalue_t rounded_size = min_size;
+  if (min_size >= FREE_LISTS_SL_COUNT) {
+    rounded_size += (1u << (log2_floor(min_size) - FREE_LISTS_SL_BITS)) - 1;
   }
 
-  // Update start of free list if needed
-  if (prev_best == NULL) {
-    if (best_next_addr == NULL) {
-      free_lists[NB_FREE_LISTS-1].first = NULL;
-      free_lists[NB_FREE_LISTS-1].last = NULL;
-    } else {
-      if (free_lists[NB_FREE_LISTS-1].first == free_lists[NB_FREE_LISTS-1].last) {
-        free_lists[NB_FREE_LISTS-1].last = addr_v_to_p(best_next_addr);
+  uvalue_t sl_bitmap = 0;
+  if (rounded_size <= MAX_BLOCK_SIZE) {
+    free_list_index(rounded_size, &fl, &sl);
+    sl_bitmap = free_lists_sl_bitmaps[fl] & (~0u << sl);
+    if (sl_bitmap == 0 && fl + 1 < FREE_LISTS_FL_COUNT) {
+      uvalue_t fl_bitmap = free_lists_fl_bitmap & (~0u << (fl + 1));
+      if (fl_bitmap != 0) {
+        fl = (unsigned int)__builtin_ctz(fl_bitmap);
+        sl_bitmap = free_lists_sl_bitmaps[fl];
       }
-      free_lists[NB_FREE_LISTS-1].first = addr_v_to_p(best_next_addr);
     }
-  } else {
-    *(prev_best + HEADER_SIZE) = best_next_addr;
-  }
-
-  // Remove current pointer from last free list and return it
-  return curr_best;
-}
-
-uvalue_t* find_free_block(const uvalue_t size) {
-  const uvalue_t initialIndex = MIN(NB_FREE_LISTS-1, size-1);
-  uvalue_t index = initialIndex;
-
-  // Check if requested size is bigger than NB_FREE_LISTS
-  if (index == NB_FREE_LISTS -1) {
-    return find_best_free_block(size);
   }
-
-  // Check if corresponding free list contains a free block otherwise update the index
-  uvalue_t* free_block = free_lists[index].first;
-  if (free_block == NULL) {
-    // Otherwise a split of size 1 can happen !
-    index = index + 2;
+  if (sl_bitmap != 0) {
+    sl = (unsigned int)__builtin_ctz(sl_bitmap);
   } else {
-    remove_first_from_free_list(index);
-    return free_block;
+    // Last resort: the first block of the list of min_size may be big enough
+    free_list_index(min_size, &fl, &sl);
+    uvalue_t* first = free_lists[fl][sl];
+    if (first == NULL || header_unpack_size(*first) < min_size) {
+      return NULL;
+    }
   }
 
-  // Iterate over the fixed size free lists to get a block
-  while (index < NB_FREE_LISTS-1) {
-    free_block = free_lists[index].first;
+  uvalue_t* free_block = remove_first_from_free_list(fl, sl);
+  const uvalue_t block_size = header_unpack_size(*free_block);
+  assert(is_valid_size_block(*free_block, size) && block_size != size);
 
-    if (free_block == NULL) {
-      index = MIN(index+1, NB_FREE_LISTS-1);
-    } else {
-      // Free list at index contains block of size index+1
-      uvalue_t currentSize = index + 1;
-      // Check if split is needed
-      if (currentSize != size) {
-        uvalue_t* phy_addr = free_block + size + HEADER_SIZE;
-        uvalue_t new_size = currentSize - size - HEADER_SIZE;
-        assert(new_size >= 1);
-        *phy_addr = header_pack(tag_None, new_size);
-        add_to_free_list(phy_addr);
-      }
-      remove_first_from_free_list(index);
-      return free_block;
-    }
-  }
+  uvalue_t* remainder = free_block + size + HEADER_SIZE;
+  *remainder = header_pack(tag_None, block_size - size - HEADER_SIZE);
+  add_to_free_list(remainder);
+  return free_block;
+}
 
-  // Fallback in case no block was found
-  return find_best_free_block(size);
+/* Add the free memory between start and end to the free lists, as
+   blocks of at most MAX_BLOCK_SIZE words */
+static void add_range_to_free_lists(uvalue_t* start, uvalue_t* end) {
+  while (start < end) {
+    uvalue_t size = (uvalue_t)MIN((size_t)(end - start) - HEADER_SIZE,
+                                  MAX_BLOCK_SIZE);
+    // Do not leave a remainder too small to be a block
+    if ((size_t)(end - start) - HEADER_SIZE - size == HEADER_SIZE)
+      size -= 1;
+    *start = header_pack(tag_None, size);
+    add_to_free_list(start);
+    start += size + HEADER_SIZE;
+  }
 }
 
 /******************** Bitmap management ****************************/
@@ -259,101 +300,1071 @@ bool is_block(uvalue_t* block) {
   return (bitmap_start[row] & mask) != 0;
 }
 
+/******************** Large-object space ****************************/
+
+static int large_object_compare(const void* v1, const void* v2) {
+  const large_object_t* o1 = v1;
+  const large_object_t* o2 = v2;
+  return (o1->block > o2->block) - (o1->block < o2->block);
+}
+
+/* Return the large object starting at the given block, if any */
+static large_object_t* large_find(const uvalue_t* block) {
+  if (block < large_start || block >= large_end || large_count == 0) {
+    return NULL;
+  }
+  large_object_t key = { (uvalue_t*)block, 0, false };
+  return bsearch(&key, large_objects, large_count, sizeof(large_object_t),
+                 large_object_compare);
+}
+
+bool is_block_or_large(uvalue_t* block) {
+  return is_block(block) || large_find(block) != NULL;
+}
+
+/* Allocate a block of the given size in the first free pages of the
+   large-object space which can hold it, or return NULL if none can */
+static uvalue_t* large_allocate(const uvalue_t size) {
+  const size_t page_words = page_size / sizeof(uvalue_t);
+  const size_t words = (size + HEADER_SIZE + page_words - 1) / page_words * page_words;
+
+  size_t index = 0;
+  uvalue_t* block = large_start;
+  for (; index < large_count; index++) {
+    if ((size_t)(large_objects[index].block - block) >= words) {
+      break;
+    }
+    block = large_objects[index].block + large_objects[index].words;
+  }
+  if (block == NULL || (size_t)(large_end - block) < words) {
+    return NULL;
+  }
+
+  if (large_count == large_capacity) {
+    large_capacity = large_capacity == 0 ? 16 : 2 * large_capacity;
+    large_objects = realloc(large_objects, large_capacity * sizeof(large_object_t));
+    if (large_objects == NULL)
+      fail("cannot allocate memory for the large-object table");
+  }
+  memmove(&large_objects[index + 1], &large_objects[index],
+          (large_count - index) * sizeof(large_object_t));
+  large_objects[index] = (large_object_t){ block, words, false };
+  large_count++;
+  large_allocated_words += words;
+  return block;
+}
+
+/* Free the large objects which were not marked, giving their pages back
+   to the system, and clear the marks of the others */
+static void large_sweep() {
+  size_t kept = 0;
+  large_live_words = 0;
+  for (size_t i = 0; i < large_count; i++) {
+    large_object_t* object = &large_objects[i];
+    if (object->marked) {
+      object->marked = false;
+      large_objects[kept++] = *object;
+      large_live_words += object->words;
+    } else {
+      madvise(object->block, object->words * sizeof(uvalue_t), MADV_DONTNEED);
+    }
+  }
+  large_count = kept;
+  large_allocated_words = 0;
+}
 
 /******************** Mark And Sweep ****************************/
 
-bool can_coalesce(const uvalue_t* b1, const uvalue_t* b2) {
-  assert(b1 < b2);
-  uvalue_t size = header_unpack_size(*b1);
-  return b1 + size + HEADER_SIZE == b2;
+/* Marker, i.e. thread marking the heap. Its stack contains blocks that
+   are marked but whose children have not been marked yet. When it is
+   full, blocks are marked without being pushed, and the heap is
+   rescanned once all stacks have been drained. During a parallel
+   marking, a marker with enough blocks in its stack moves some of them
+   to its shared stack, from which idle markers steal them. */
+typedef struct {
+  uvalue_t* stack[MARK_STACK_SIZE];
+  size_t stack_size;
+  uvalue_t* shared[MARK_SHARED_SIZE];
+  size_t shared_size;           /* read without the lock by thieves */
+  pthread_mutex_t shared_lock;
+  pthread_t thread;
+} marker_t;
+
+static unsigned int markers_count = 1;
+static marker_t* markers = NULL;
+static bool marking_in_parallel = false;
+static bool mark_stack_overflowed = false;
+static bool frames_are_precise = false; /* see gc_collect */
+static unsigned int idle_markers = 0;
+
+/* Set the mark of the given block, and return true if it was not
+   already set. During a parallel marking, the bit is set atomically, as
+   other markers may set bits of the same word. Large objects have their
+   mark in their entry of the table. */
+static bool mark_set(const uvalue_t* block) {
+  if (block >= large_start && block < large_end) {
+    bool* marked = &large_find(block)->marked;
+    if (marking_in_parallel) {
+      return !__atomic_exchange_n(marked, true, __ATOMIC_RELAXED);
+    } else if (!*marked) {
+      *marked = true;
+      return true;
+    } else {
+      return false;
+    }
+  }
+  const size_t index = block - heap_start;
+  uvalue_t* word = &mark_bitmap_start[index / VALUE_BITS];
+  const uvalue_t mask = 1u << (index % VALUE_BITS);
+  if (marking_in_parallel) {
+    return (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) == 0;
+  } else if ((*word & mask) == 0) {
+    *word |= mask;
+    return true;
+  } else {
+    return false;
+  }
 }
 
-void mark(uvalue_t* root) {
+static void mark_push(marker_t* marker, uvalue_t* block) {
+  if (!mark_set(block)) {
+    return;
+  }
+  if (marker->stack_size < MARK_STACK_SIZE) {
+    marker->stack[marker->stack_size++] = block;
+  } else {
+    __atomic_store_n(&mark_stack_overflowed, true, __ATOMIC_RELAXED);
+  }
+}
+
+static void mark_children(marker_t* marker, const uvalue_t* block) {
+  // The live registers of frames are marked as roots
+  if (frames_are_precise && header_unpack_tag(*block) == tag_RegisterFrame) {
+    return;
+  }
+  uvalue_t size = header_unpack_size(*block);
+  for (size_t i = 1; i <= size; i++) {
+    uvalue_t child = block[i];
+    // Block addresses should be byte aligned
+    if ((child & 0x03u) == 0) {
+      uvalue_t* child_block = (uvalue_t*)addr_v_to_p(child) - HEADER_SIZE;
+      if (is_block_or_large(child_block)) {
+        mark_push(marker, child_block);
+      }
+    }
+  }
+}
+
+/* Move half of the stack of the marker to its shared stack, if the
+   latter is empty */
+static void mark_share(marker_t* marker) {
+  if (__atomic_load_n(&marker->shared_size, __ATOMIC_RELAXED) != 0) {
+    return;
+  }
+  pthread_mutex_lock(&marker->shared_lock);
+  if (marker->shared_size == 0) {
+    size_t count = MIN(marker->stack_size / 2, MARK_SHARED_SIZE);
+    marker->stack_size -= count;
+    memcpy(marker->shared,
+           &marker->stack[marker->stack_size],
+           count * sizeof(uvalue_t*));
+    __atomic_store_n(&marker->shared_size, count, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&marker->shared_lock);
+}
+
+/* Mark the children of all the blocks of the stack, until it is empty.
+   Popped blocks go through a small queue, and their header is prefetched
+   when they enter it, so that it is in cache once they leave it. */
+static void mark_drain(marker_t* marker) {
+  uvalue_t* queue[MARK_PREFETCH_DISTANCE];
+  size_t queue_head = 0;
+  size_t queue_size = 0;
+
+  while (marker->stack_size > 0 || queue_size > 0) {
+    if (marking_in_parallel && marker->stack_size >= MARK_SHARE_THRESHOLD) {
+      mark_share(marker);
+    }
+    while (queue_size < MARK_PREFETCH_DISTANCE && marker->stack_size > 0) {
+      uvalue_t* block = marker->stack[--marker->stack_size];
+      __builtin_prefetch(block);
+      queue[(queue_head + queue_size) % MARK_PREFETCH_DISTANCE] = block;
+      queue_size++;
+    }
+    uvalue_t* block = queue[queue_head];
+    queue_head = (queue_head + 1) % MARK_PREFETCH_DISTANCE;
+    queue_size--;
+    mark_children(marker, block);
+  }
+}
+
+/* Move the shared stack of some marker (starting with the given one)
+   to the stack of the given marker, which is empty. Return false if
+   all shared stacks are empty. */
+static bool mark_steal(marker_t* marker) {
+  const size_t index = (size_t)(marker - markers);
+  for (size_t i = 0; i < markers_count; i++) {
+    marker_t* victim = &markers[(index + i) % markers_count];
+    if (__atomic_load_n(&victim->shared_size, __ATOMIC_RELAXED) == 0) {
+      continue;
+    }
+    pthread_mutex_lock(&victim->shared_lock);
+    size_t count = victim->shared_size;
+    memcpy(marker->stack, victim->shared, count * sizeof(uvalue_t*));
+    __atomic_store_n(&victim->shared_size, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&victim->shared_lock);
+    if (count > 0) {
+      marker->stack_size = count;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool mark_work_is_shared() {
+  for (size_t i = 0; i < markers_count; i++) {
+    if (__atomic_load_n(&markers[i].shared_size, __ATOMIC_RELAXED) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Body of a marker thread. Marking is over once all markers are idle,
+   i.e. have empty stacks and found no shared stack to steal. */
+static void* mark_thread(void* arg) {
+  marker_t* marker = arg;
+  for (;;) {
+    mark_drain(marker);
+    if (mark_steal(marker)) {
+      continue;
+    }
+    __atomic_fetch_add(&idle_markers, 1, __ATOMIC_ACQ_REL);
+    for (;;) {
+      if (__atomic_load_n(&idle_markers, __ATOMIC_ACQUIRE) == markers_count) {
+        return NULL;
+      }
+      if (mark_work_is_shared()) {
+        __atomic_fetch_sub(&idle_markers, 1, __ATOMIC_ACQ_REL);
+        break;
+      }
+      sched_yield();
+    }
+  }
+}
+
+/* Mark the children of all the marked blocks of the heap, found in
+   the mark bitmap, to recover from an overflow of the mark stack. */
+static void mark_rescan_heap() {
+  mark_stack_overflowed = false;
+  for (size_t row = 0; row < bitmap_rows; row++) {
+    // The row is read again after each block, which may mark others
+    for (uvalue_t marked = mark_bitmap_start[row]; marked != 0; ) {
+      unsigned int col = (unsigned int)__builtin_ctz(marked);
+      mark_children(&markers[0], heap_start + row * VALUE_BITS + col);
+      mark_drain(&markers[0]);
+      marked = mark_bitmap_start[row] & (~1u << col);
+    }
+  }
+  for (size_t i = 0; i < large_count; i++) {
+    if (large_objects[i].marked) {
+      mark_children(&markers[0], large_objects[i].block);
+      mark_drain(&markers[0]);
+    }
+  }
+}
+
+/* Push the given root on the stack of the given marker, if it points
+   to an allocated block */
+static void mark_root(marker_t* marker, uvalue_t* root) {
   // Get the header of the block, since user have pointers to bodies
   root = root - HEADER_SIZE;
 
-  if (is_block(root)) {
-    uvalue_t size = header_unpack_size(*root);
-    unset_block_bitmap(root);
-    for(size_t i = 1; i <= size; i++) {
-      uvalue_t child = root[i];
-      // Block addresses should be byte aligned
-      if ((child & 0x03u) == 0) {
-        mark(addr_v_to_p(child));
+  if (is_block_or_large(root)) {
+    mark_push(marker, root);
+  }
+}
+
+void mark(uvalue_t* root) {
+  mark_root(&markers[0], root);
+  mark_drain(&markers[0]);
+  while (mark_stack_overflowed) {
+    mark_rescan_heap();
+  }
+}
+
+/* Mark the value of the given register, if it may be a pointer */
+static void mark_register(uvalue_t* reg) {
+  if ((*reg & 0x03u) == 0) {
+    mark(addr_v_to_p(*reg));
+  }
+}
+
+void mark_frames(uvalue_t* start, uvalue_t* end) {
+  for (uvalue_t* curr = start; curr < end; curr++) {
+    mark_register(curr);
+  }
+}
+
+/* Index of the marker to which the next root is given */
+static size_t next_root_marker = 0;
+
+static void mark_parallel_register(uvalue_t* reg) {
+  if ((*reg & 0x03u) == 0) {
+    mark_root(&markers[next_root_marker++ % markers_count],
+              addr_v_to_p(*reg));
+  }
+}
+
+void mark_parallel() {
+  uvalue_t* roots[] = { engine_get_Ib(), engine_get_Ob(), engine_get_Lb() };
+  next_root_marker = 0;
+  for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+    mark_root(&markers[next_root_marker++ % markers_count], roots[i]);
+  }
+  if (frames_are_precise) {
+    engine_for_each_live_register(mark_parallel_register);
+  } else {
+    uvalue_t* frames_end = engine_get_frames_top();
+    for (uvalue_t* curr = engine_get_frames_start(); curr < frames_end; curr++)
+      mark_parallel_register(curr);
+  }
+
+  marking_in_parallel = true;
+  idle_markers = 0;
+  for (size_t i = 1; i < markers_count; i++) {
+    if (pthread_create(&markers[i].thread, NULL, mark_thread, &markers[i]) != 0)
+      fail("cannot create marker thread");
+  }
+  mark_thread(&markers[0]);
+  for (size_t i = 1; i < markers_count; i++) {
+    pthread_join(markers[i].thread, NULL);
+  }
+  marking_in_parallel = false;
+
+  while (mark_stack_overflowed) {
+    mark_rescan_heap();
+  }
+}
+
+/******************** Heap sizing ****************************/
+
+static char* page_down(void* address) {
+  return (char*)((uintptr_t)address & ~(uintptr_t)(page_size - 1));
+}
+
+static char* page_up(void* address) {
+  return page_down((char*)address + page_size - 1);
+}
+
+static size_t round_up_to_chunk(size_t words) {
+  return (words + HEAP_CHUNK_SIZE - 1) / HEAP_CHUNK_SIZE * HEAP_CHUNK_SIZE;
+}
+
+/* Add the free memory between start and end to the free lists, up to
+   the heap limit. The pages of the part after the limit are given back
+   to the system, which zeroes them. */
+static void add_free_range(uvalue_t* start, uvalue_t* end) {
+  uvalue_t* limit = MIN(end, heap_limit);
+  if (start < limit && limit - start > HEADER_SIZE) {
+    add_range_to_free_lists(start, limit);
+  }
+  char* pages_start = page_up(MAX(start, heap_limit));
+  char* pages_end = page_down(end);
+  if (pages_start < pages_end) {
+    madvise(pages_start, (size_t)(pages_end - pages_start), MADV_DONTNEED);
+  }
+}
+
+/* Add the free memory between the blocks allocated in the given rows
+   of the bitmap and after free_start to the free lists, and return the
+   end of the last of these blocks. Empty rows are skipped. */
+static uvalue_t* add_free_rows(size_t row,
+                               const size_t row_end,
+                               uvalue_t* free_start,
+                               size_t* live_words) {
+  for (; row < row_end; row++) {
+    for (uvalue_t allocated = bitmap_start[row];
+         allocated != 0;
+         allocated &= allocated - 1) {
+      uvalue_t* block = heap_start + row * VALUE_BITS + (size_t)__builtin_ctz(allocated);
+      if (block < free_start) {
+        continue;
       }
+      if (block > free_start) {
+        add_free_range(free_start, block);
+      }
+      const uvalue_t block_words = header_unpack_size(*block) + HEADER_SIZE;
+      free_start = block + block_words;
+      *live_words += block_words;
     }
   }
+  return free_start;
 }
 
-void sweep() {
+/* Return the end of the last block allocated before the given address,
+   or the start of the heap if there is none */
+static uvalue_t* end_of_block_before(uvalue_t* address) {
+  const size_t index = (size_t)(address - heap_start);
+  size_t row = index / VALUE_BITS;
+  uvalue_t allocated = bitmap_start[row] & ((1u << (index % VALUE_BITS)) - 1);
+  while (allocated == 0) {
+    if (row == 0) {
+      return heap_start;
+    }
+    allocated = bitmap_start[--row];
+  }
+  uvalue_t* block = heap_start + row * VALUE_BITS
+    + (VALUE_BITS - 1 - (size_t)__builtin_clz(allocated));
+  return block + header_unpack_size(*block) + HEADER_SIZE;
+}
+
+void heap_set_size(const size_t size) {
+  assert(heap_min_size <= size && size <= heap_max_size);
+  uvalue_t* new_end = heap_start + size;
+  assert(new_end <= large_start);
+
+  if (new_end > memory_end) {
+    char* start = page_down(memory_end);
+    if (mprotect(start, (size_t)(page_up(new_end) - start), PROT_READ | PROT_WRITE) != 0)
+      fail("cannot grow the heap to %zd bytes", size * sizeof(uvalue_t));
+  } else {
+    char* start = page_up(new_end);
+    char* end = page_up(memory_end);
+    if (end > start) {
+      madvise(start, (size_t)(end - start), MADV_DONTNEED);
+      mprotect(start, (size_t)(end - start), PROT_NONE);
+    }
+  }
+  memory_end = heap_limit = new_end;
+  __atomic_store_n(&bitmap_rows, (size + VALUE_BITS - 1) / VALUE_BITS, __ATOMIC_RELAXED);
+}
+
+/* Raise the heap limit, adding the free memory below it to the free
+   lists. The heap must be completely swept. */
+static void heap_raise_limit(uvalue_t* new_limit) {
+  uvalue_t* old_limit = heap_limit;
+  assert(old_limit <= new_limit && new_limit <= memory_end);
+  if (old_limit == memory_end) {
+    return;
+  }
+  heap_limit = new_limit;
+
+  size_t live_words = 0;
+  uvalue_t* free_start = add_free_rows((size_t)(old_limit - heap_start) / VALUE_BITS,
+                                       bitmap_rows,
+                                       MAX(old_limit, end_of_block_before(old_limit)),
+                                       &live_words);
+  add_free_range(free_start, memory_end);
+}
+
+/* Grow the heap to the given size, and add the new memory to the free
+   lists. The heap must be completely swept. */
+static void heap_grow_to(const size_t size) {
+  heap_raise_limit(memory_end);
+  uvalue_t* old_end = memory_end;
+  heap_set_size(size);
+  add_free_range(old_end, memory_end);
+}
+
+void heap_resize(uvalue_t* live_end) {
+  // Once no block is allocated after the limit, which was lowered by a
+  // previous collection, the memory after it is given back
+  if (heap_limit < memory_end && live_end <= heap_limit) {
+    heap_set_size((size_t)(heap_limit - heap_start));
+  }
+
+  const size_t size = (size_t)(heap_limit - heap_start);
+  const size_t live = sweep_live_words;
+  size_t wanted = round_up_to_chunk(live * 100 / heap_target);
+  wanted = MAX(heap_min_size, MIN(wanted, heap_max_size));
+
+  if (live * 100 > size * heap_target) {
+    heap_low_collections = 0;
+    if (heap_start + wanted > memory_end) {
+      heap_grow_to(wanted);
+    } else if (wanted > size) {
+      heap_raise_limit(heap_start + wanted);
+    }
+  } else if (live * 200 < size * heap_target) {
+    heap_low_collections++;
+    if (heap_low_collections >= HEAP_SHRINK_COLLECTIONS && wanted < size) {
+      // Blocks are only allocated before the limit from the next
+      // collection on, so that the heap can then be truncated
+      heap_low_collections = 0;
+      heap_limit = heap_start + wanted;
+    }
+  } else {
+    heap_low_collections = 0;
+  }
+}
+
+bool heap_grow(const uvalue_t block_size) {
+  bool grown = true;
+  if (sweeper_running) {
+    pthread_mutex_lock(&sweep_lock);
+  }
+  assert(sweep_row >= bitmap_rows);
+  // Free memory is found after the limit using the bitmap
+  buffer_retire();
+  if (heap_limit < memory_end) {
+    heap_raise_limit(memory_end);
+  } else {
+    // The new memory must hold a block that can be split
+    const size_t size = (size_t)(memory_end - heap_start);
+    const size_t needed = size + block_size + 2 * HEADER_SIZE + 1;
+    const size_t wanted = MIN(round_up_to_chunk(needed), heap_max_size);
+    if (wanted >= needed) {
+      heap_grow_to(wanted);
+    } else {
+      grown = false;
+    }
+  }
+  // The rows of a grown heap are empty, and the sweep stays complete
+  sweep_free_start = memory_end;
+  __atomic_store_n(&sweep_row, bitmap_rows, __ATOMIC_RELEASE);
+  if (sweeper_running) {
+    pthread_mutex_unlock(&sweep_lock);
+  }
+  return grown;
+}
+
+void sweep_start() {
+  if (sweeper_running) {
+    pthread_mutex_lock(&sweep_lock);
+  }
   reset_free_lists();
+  sweep_free_start = heap_start;
+  sweep_live_words = 0;
+  __atomic_store_n(&sweep_row, 0, __ATOMIC_RELEASE);
+  if (sweeper_running) {
+    pthread_cond_signal(&sweep_started);
+    pthread_mutex_unlock(&sweep_lock);
+  }
+}
 
-  uvalue_t* prev = NULL;
-  uvalue_t* curr = heap_start;
-  assert(curr != NULL);
-
-  while (curr < memory_end) {
-    assert(curr >= heap_start && curr < memory_end);
-    // Check if block can be freed
-    if(is_block(curr) || header_unpack_tag(*curr) == tag_None) {
-      uvalue_t sizeCurr = header_unpack_size(*curr);
-
-      if (prev != NULL && can_coalesce(prev, curr)) {
-        // Coalescing can be done, it updates the size of the block
-        uvalue_t sizePrev = header_unpack_size(*prev);
-        *prev = header_pack(tag_None, sizePrev + sizeCurr + HEADER_SIZE);
-      } else {
-        if (prev != NULL) {
-          // Non-consecutive blocks, we can add prev to the corresponding free list
-          add_to_free_list(prev);
-        }
-
-        prev = curr;
-        *curr = header_pack(tag_None, sizeCurr); // Reset tag
-        *(curr + HEADER_SIZE) = NULL; // Reset body
+/* Record the state of the heap and the lengths of the free lists after
+   a complete sweep */
+static void record_heap_statistics() {
+  size_t free_words = 0;
+  size_t largest_free_words = 0;
+  for (unsigned int fl = 0; fl < FREE_LISTS_FL_COUNT; fl++) {
+    for (unsigned int sl = 0; sl < FREE_LISTS_SL_COUNT; sl++) {
+      size_t length = 0;
+      for (uvalue_t* block = free_lists[fl][sl]; block != NULL; length++) {
+        const size_t block_words = header_unpack_size(*block) + HEADER_SIZE;
+        free_words += block_words;
+        largest_free_words = MAX(largest_free_words, block_words);
+        const uvalue_t next_virtual = *(block + HEADER_SIZE);
+        block = next_virtual == 0 ? NULL : addr_v_to_p(next_virtual);
       }
-      // Update the bitmap, since this block is free
-      unset_block_bitmap(curr);
-    } else {
-      // This block is allocated and can't be freed, hence the bitmap is updated
-      set_block_bitmap(curr);
+      if (length > 0) {
+        const size_t min_size = fl == 0 ? sl : (FREE_LISTS_SL_COUNT + sl) << (fl - 1);
+        statistics_record_free_list(fl * FREE_LISTS_SL_COUNT + sl, min_size, length);
+      }
+    }
+  }
+  statistics_record_heap(sweep_live_words + large_live_words,
+                         (size_t)(heap_limit - heap_start),
+                         free_words,
+                         largest_free_words);
+}
+
+bool sweep_step() {
+  if (sweep_row >= bitmap_rows) {
+    return false;
+  }
+  const uint64_t start_time = record_statistics ? statistics_clock() : 0;
+  size_t row_end = MIN(bitmap_rows, sweep_row + SWEEP_STEP_SIZE / VALUE_BITS);
+
+  // The live blocks are the marked ones, which are the only ones left
+  // allocated, and all the marks are cleared (a loop that the compiler
+  // can vectorize)
+  for (size_t row = sweep_row; row < row_end; row++) {
+    bitmap_start[row] &= mark_bitmap_start[row];
+    mark_bitmap_start[row] = 0;
+  }
+
+  // Everything between two live blocks is free, and is coalesced
+  // without reading its headers
+  uvalue_t* free_start = add_free_rows(sweep_row, row_end, sweep_free_start,
+                                       &sweep_live_words);
+
+  // The last free run is only closed by the next live block, or the end
+  // of the heap, so that it is coalesced across steps. Once the live
+  // blocks are all known, the heap is resized.
+  const bool complete = row_end == bitmap_rows;
+  if (complete) {
+    uvalue_t* live_end = free_start;
+    add_free_range(free_start, memory_end);
+    heap_resize(live_end);
+    free_start = memory_end;
+    row_end = bitmap_rows;      // the rows of a grown heap are empty
+  }
+  sweep_free_start = free_start;
+  if (record_statistics) {
+    sweep_nanoseconds += statistics_clock() - start_time;
+    if (complete) {
+      statistics_record_phase(statistics_sweep, sweep_nanoseconds);
+      sweep_nanoseconds = 0;
+      record_heap_statistics();
+    }
+  }
+  // Publish the free lists to a mutator allocating without the lock
+  __atomic_store_n(&sweep_row, row_end, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* Body of the background sweeper thread, which sweeps the heap after
+   each collection, one step at a time, while the mutator runs. */
+static void* sweeper_thread(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&sweep_lock);
+  for (;;) {
+    while (!sweeper_stopping && sweep_row >= bitmap_rows) {
+      pthread_cond_wait(&sweep_started, &sweep_lock);
     }
+    if (sweeper_stopping) {
+      break;
+    }
+    sweep_step();
+    // Let the mutator allocate between two steps
+    pthread_mutex_unlock(&sweep_lock);
+    sched_yield();
+    pthread_mutex_lock(&sweep_lock);
+  }
+  pthread_mutex_unlock(&sweep_lock);
+  return NULL;
+}
 
-    // Update curr pointer
-    uvalue_t size = header_unpack_size(*curr);
-    curr += size + HEADER_SIZE;
+/* While the background sweeper is sweeping, the free lists and the
+   bitmap are only accessed by the mutator with the lock held. Take it
+   if needed, and return true if it was taken. */
+static bool sweep_lock_if_sweeping() {
+  // The number of rows only changes at the end of a sweep, which stores
+  // it into sweep_row, so that a sweep_row at least as large as the
+  // number of rows read before it was stored by a complete sweep
+  const size_t rows = __atomic_load_n(&bitmap_rows, __ATOMIC_RELAXED);
+  const bool locked = sweeper_running
+    && __atomic_load_n(&sweep_row, __ATOMIC_ACQUIRE) < rows;
+  if (locked) {
+    pthread_mutex_lock(&sweep_lock);
   }
+  return locked;
+}
 
-  // Check if the last prev pointer wasn't added to a free list
-  if (prev != NULL && header_unpack_tag(*prev) == tag_None) {
-    add_to_free_list(prev);
+/* Find a free block of the given size, sweeping the heap until one is
+   found. The mutator performs the next step itself rather than waiting
+   for the background sweeper. The lock must be held while the latter is
+   sweeping. */
+static uvalue_t* find_free_block_sweeping(const uvalue_t size) {
+  uvalue_t* block = find_free_block(size);
+  while (block == NULL && sweep_step()) {
+    block = find_free_block(size);
   }
+  return block;
+}
+
+/* Find a free block for an allocation buffer of at least the given
+   size, in words, and store its size in *buffer_size. The biggest
+   buffer size, then halved ones down to min_size, are looked for in
+   the free lists before sweeping each step, so that a fragmented heap
+   is only swept until a block of min_size is found. The lock must be
+   held while the background sweeper is sweeping. */
+static uvalue_t* find_buffer_block_sweeping(const uvalue_t min_size,
+                                            uvalue_t* buffer_size) {
+  do {
+    for (uvalue_t size = ALLOCATION_BUFFER_SIZE; size >= min_size; size /= 2) {
+      uvalue_t* block = find_free_block(size - HEADER_SIZE);
+      if (block != NULL) {
+        *buffer_size = size;
+        return block;
+      }
+    }
+  } while (sweep_step());
+  return NULL;
+}
+
+/* Complete the current sweep, which must be done before a collection */
+static void sweep_complete() {
+  const bool locked = sweep_lock_if_sweeping();
+  while (sweep_step()) {
+  }
+  if (locked) {
+    pthread_mutex_unlock(&sweep_lock);
+  }
+}
+
+static uvalue_t* find_free_block_or_sweep(const uvalue_t size) {
+  const bool locked = sweep_lock_if_sweeping();
+  uvalue_t* block = find_free_block_sweeping(size);
+  if (block != NULL) {
+    set_block_bitmap(block);
+  }
+  if (locked) {
+    pthread_mutex_unlock(&sweep_lock);
+  }
+  return block;
+}
+
+/* Set the blocks allocated in the allocation buffer in the bitmap, and
+   give the rest of it back to the free lists. The lock must be held
+   while the background sweeper is sweeping. */
+static void buffer_retire(void) {
+  if (record_statistics) {
+    statistics_record_blocks(buffer_start, buffer.top);
+  }
+  for (uvalue_t* block = buffer_start;
+       block < buffer.top;
+       block += header_unpack_size(*block) + HEADER_SIZE) {
+    set_block_bitmap(block);
+  }
+  if (buffer.top != NULL) {
+    add_free_range(buffer.top, buffer.end);
+  }
+  buffer.top = buffer.end = buffer_start = NULL;
+}
+
+static void buffer_fill(uvalue_t* start, uvalue_t* end) {
+  buffer.top = buffer_start = start;
+  buffer.end = end;
+}
+
+/* Allocate a block of the given size in the allocation buffer, if it
+   fits */
+static uvalue_t* buffer_allocate(const uvalue_t size) {
+  uvalue_t* block = buffer.top;
+  if ((size_t)(buffer.end - block) < size + HEADER_SIZE) {
+    return NULL;
+  }
+  buffer.top = block + size + HEADER_SIZE;
+  return block;
+}
+
+void sweep() {
+  sweep_start();
+  if (sweeper_running) {
+    pthread_mutex_lock(&sweep_lock);
+  }
+  while (sweep_step()) {
+  }
+  if (sweeper_running) {
+    pthread_mutex_unlock(&sweep_lock);
+  }
+}
+
+/* Return the given block, given by its body as for the heap profiler,
+   if it was marked by the current collection, or NULL if it is dead */
+static uvalue_t* marked_survivor(uvalue_t* body) {
+  uvalue_t* block = body - HEADER_SIZE;
+  if (block >= large_start && block < large_end) {
+    large_object_t* object = large_find(block);
+    return object != NULL && object->marked ? body : NULL;
+  }
+  const size_t index = block - heap_start;
+  const uvalue_t mask = 1u << (index % VALUE_BITS);
+  return (mark_bitmap_start[index / VALUE_BITS] & mask) != 0 ? body : NULL;
 }
 
 void gc_collect() {
-  mark(engine_get_Ib());
-  mark(engine_get_Ob());
-  mark(engine_get_Lb());
+  // Marking relies on the bitmaps left by a complete sweep, after which
+  // the background sweeper is idle
+  assert(__atomic_load_n(&sweep_row, __ATOMIC_ACQUIRE) >= bitmap_rows);
+  buffer_retire();
+  const uint64_t start_time = record_statistics ? statistics_clock() : 0;
+
+  // With liveness maps, the engine gives the live registers of the
+  // frames, which are then marked without their contents
+  frames_are_precise = engine_has_liveness();
+
+  if (markers_count > 1) {
+    mark_parallel();
+  } else {
+    mark(engine_get_Ib());
+    mark(engine_get_Ob());
+    mark(engine_get_Lb());
+    if (frames_are_precise) {
+      engine_for_each_live_register(mark_register);
+    } else {
+      mark_frames(engine_get_frames_start(), engine_get_frames_top());
+    }
+  }
+  if (record_statistics) {
+    statistics_record_phase(statistics_mark, statistics_clock() - start_time);
+  }
+  if (heap_profiler_is_running()) {
+    heap_profiler_census(marked_survivor);
+  }
+  const uint64_t sweep_time = record_statistics ? statistics_clock() : 0;
+  large_sweep();
+  if (record_statistics) {
+    sweep_nanoseconds = statistics_clock() - sweep_time;
+  }
+
+  if (compact_always) {
+    sweep();
+    compact();
+  } else {
+    sweep_start();
+  }
+}
+
+/******************** Compaction ****************************/
+
+/* Fill the forwarding table, whose entry for each row of the bitmap is
+   the offset from the start of the heap to which its first block is
+   moved: the blocks are slid towards the start of the heap, in order. */
+static void compact_compute_table() {
+  if (compact_table_rows < bitmap_rows) {
+    free(compact_table);
+    compact_table = malloc(bitmap_rows * sizeof(uvalue_t));
+    if (compact_table == NULL)
+      fail("cannot allocate memory for the forwarding table");
+    compact_table_rows = bitmap_rows;
+  }
+  uvalue_t offset = 0;
+  for (size_t row = 0; row < bitmap_rows; row++) {
+    compact_table[row] = offset;
+    for (uvalue_t allocated = bitmap_start[row];
+         allocated != 0;
+         allocated &= allocated - 1) {
+      const uvalue_t* block = heap_start + row * VALUE_BITS + (size_t)__builtin_ctz(allocated);
+      offset += header_unpack_size(*block) + HEADER_SIZE;
+    }
+  }
+}
+
+/* Return the address to which the given block is moved, i.e. the one
+   of the first block of its row, followed by the blocks before it in
+   that row */
+static uvalue_t* compact_forward(const uvalue_t* block) {
+  const size_t index = (size_t)(block - heap_start);
+  const size_t row = index / VALUE_BITS;
+  uvalue_t* target = heap_start + compact_table[row];
+  for (uvalue_t before = bitmap_start[row] & ((1u << (index % VALUE_BITS)) - 1);
+       before != 0;
+       before &= before - 1) {
+    const uvalue_t* other = heap_start + row * VALUE_BITS + (size_t)__builtin_ctz(before);
+    target += header_unpack_size(*other) + HEADER_SIZE;
+  }
+  return target;
+}
+
+/* Return the given value, updated if it points to an allocated block */
+static uvalue_t compact_forward_value(const uvalue_t value) {
+  if ((value & 0x03u) == 0) {
+    uvalue_t* block = (uvalue_t*)addr_v_to_p(value) - HEADER_SIZE;
+    if (is_block(block)) {
+      return addr_p_to_v(compact_forward(block) + HEADER_SIZE);
+    }
+  }
+  return value;
+}
+
+static uvalue_t* compact_forward_base(uvalue_t* base) {
+  uvalue_t* block = base - HEADER_SIZE;
+  return is_block(block) ? compact_forward(block) + HEADER_SIZE : base;
+}
+
+/* Return the address to which the given block, given by its body as
+   for the heap profiler, is moved, or NULL if it is not a block */
+static uvalue_t* compact_forward_profiled(uvalue_t* body) {
+  uvalue_t* block = body - HEADER_SIZE;
+  if (is_block(block)) {
+    return compact_forward(block) + HEADER_SIZE;
+  }
+  return large_find(block) != NULL ? body : NULL;
+}
+
+void compact() {
+  const uint64_t start_time = record_statistics ? statistics_clock() : 0;
+  if (sweeper_running) {
+    pthread_mutex_lock(&sweep_lock);
+  }
+  assert(sweep_row >= bitmap_rows);
+  buffer_retire();
+  reset_free_lists();
+  compact_compute_table();
+  if (heap_profiler_is_running()) {
+    heap_profiler_move(compact_forward_profiled);
+  }
+
+  // Pointers are updated while the blocks are still at their old address
+  engine_set_Ib(compact_forward_base(engine_get_Ib()));
+  engine_set_Ob(compact_forward_base(engine_get_Ob()));
+  engine_set_Lb(compact_forward_base(engine_get_Lb()));
+  uvalue_t* frames_end = engine_get_frames_top();
+  for (uvalue_t* curr = engine_get_frames_start(); curr < frames_end; curr++) {
+    *curr = compact_forward_value(*curr);
+  }
+  for (size_t row = 0; row < bitmap_rows; row++) {
+    for (uvalue_t allocated = bitmap_start[row];
+         allocated != 0;
+         allocated &= allocated - 1) {
+      uvalue_t* block = heap_start + row * VALUE_BITS + (size_t)__builtin_ctz(allocated);
+      const uvalue_t size = header_unpack_size(*block);
+      for (size_t i = 1; i <= size; i++) {
+        block[i] = compact_forward_value(block[i]);
+      }
+    }
+  }
+  for (size_t o = 0; o < large_count; o++) {
+    uvalue_t* block = large_objects[o].block;
+    const uvalue_t size = header_unpack_size(*block);
+    for (size_t i = 1; i <= size; i++) {
+      block[i] = compact_forward_value(block[i]);
+    }
+  }
+
+  // Blocks are then moved in order, so that they never overwrite one
+  // which has not been moved yet, and so are their bits, which are only
+  // set in rows already read
+  uvalue_t* top = heap_start;
+  for (size_t row = 0; row < bitmap_rows; row++) {
+    uvalue_t allocated = bitmap_start[row];
+    bitmap_start[row] = 0;
+    for (; allocated != 0; allocated &= allocated - 1) {
+      uvalue_t* block = heap_start + row * VALUE_BITS + (size_t)__builtin_ctz(allocated);
+      const size_t block_words = header_unpack_size(*block) + HEADER_SIZE;
+      memmove(top, block, block_words * sizeof(uvalue_t));
+      set_block_bitmap(top);
+      top += block_words;
+    }
+  }
 
-  sweep();
+  // The heap can now be truncated at its limit, if it was lowered, and
+  // the memory after the last block is the allocation buffer
+  if (heap_limit < memory_end) {
+    if (top <= heap_limit) {
+      heap_set_size((size_t)(heap_limit - heap_start));
+    } else {
+      heap_limit = memory_end;
+    }
+  }
+  buffer_fill(top, heap_limit);
+  sweep_free_start = memory_end;
+  __atomic_store_n(&sweep_row, bitmap_rows, __ATOMIC_RELEASE);
+  if (sweeper_running) {
+    pthread_mutex_unlock(&sweep_lock);
+  }
+  if (record_statistics) {
+    statistics_record_phase(statistics_compact, statistics_clock() - start_time);
+  }
 }
 
 /******************** Memory Management ****************************/
 
 void memory_setup(size_t total_byte_size) {
-  memory_start = calloc(total_byte_size, 1);
-  if (memory_start == NULL)
-    fail("cannot allocate %zd bytes of memory", total_byte_size);
-
+  page_size = (size_t)sysconf(_SC_PAGESIZE);
+  record_statistics = statistics_are_enabled();
+
+  // Address space is reserved for the biggest heap and its bitmaps, but
+  // only the initial memory is committed
+  size_t max_heap_byte_size = MAX(heap_min_size, heap_max_size);
+  size_t reserved_byte_size = total_byte_size;
+  if (max_heap_byte_size > 0) {
+    reserved_byte_size += max_heap_byte_size + max_heap_byte_size / 16 + 2 * page_size;
+  }
+  reserved_byte_size = (reserved_byte_size + page_size - 1) & ~(page_size - 1);
+  if (reserved_byte_size > (size_t)UINT32_MAX + 1)
+    fail("memory size %zd too big for 32-bit addresses", reserved_byte_size);
+
+  // The large-object space can be as big as the biggest heap, in the
+  // rest of the 32-bit address space
+  size_t large_byte_size = MIN(MAX(total_byte_size, max_heap_byte_size),
+                               (size_t)UINT32_MAX + 1 - reserved_byte_size);
+  large_byte_size &= ~(page_size - 1);
+  reserved_byte_size += large_byte_size;
+
+  // Pages are only backed by memory once touched, so no swap space is
+  // reserved for them either
+  void* reserved = mmap(NULL, reserved_byte_size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED)
+    fail("cannot allocate %zd bytes of memory "
+         "(%zd bytes of address space reserved)",
+         total_byte_size, reserved_byte_size);
+#ifdef MADV_HUGEPAGE
+  if (huge_pages)
+    madvise(reserved, reserved_byte_size, MADV_HUGEPAGE);
+#endif
+  memory_start = reserved;
+  memory_reserved_end = memory_start + reserved_byte_size / sizeof(value_t);
+  large_start = memory_reserved_end - large_byte_size / sizeof(value_t);
+  large_end = memory_reserved_end;
   memory_end = memory_start + (total_byte_size / sizeof(value_t));
+  if (mprotect(memory_start, (size_t)(page_up(memory_end) - (char*)memory_start),
+               PROT_READ | PROT_WRITE) != 0
+      || mprotect(large_start, large_byte_size, PROT_READ | PROT_WRITE) != 0)
+    fail("cannot allocate %zd bytes of memory "
+         "(%zd bytes of address space reserved)",
+         total_byte_size, reserved_byte_size);
+
+  markers = calloc(markers_count, sizeof(marker_t));
+  if (markers == NULL)
+    fail("cannot allocate memory for %u markers", markers_count);
+  for (size_t i = 0; i < markers_count; i++) {
+    pthread_mutex_init(&markers[i].shared_lock, NULL);
+  }
+}
+
+void memory_set_heap_limits(size_t min_byte_size,
+                            size_t max_byte_size,
+                            unsigned int target) {
+  assert(memory_start == NULL && target <= 100);
+  heap_min_size = min_byte_size;
+  heap_max_size = max_byte_size;
+  heap_target = target != 0 ? target : HEAP_TARGET_DEFAULT;
+}
+
+void memory_set_compact_always(bool always) {
+  assert(memory_start == NULL);
+  compact_always = always;
+}
+
+void memory_set_gc_threads(unsigned int count) {
+  assert(memory_start == NULL && count > 0);
+  markers_count = count;
+}
+
+void memory_set_huge_pages(bool huge) {
+  assert(memory_start == NULL);
+  huge_pages = huge;
 }
 
 void memory_cleanup() {
   assert(memory_start != NULL);
+  if (sweeper_running) {
+    pthread_mutex_lock(&sweep_lock);
+    sweeper_stopping = true;
+    pthread_cond_signal(&sweep_started);
+    pthread_mutex_unlock(&sweep_lock);
+    pthread_join(sweeper, NULL);
+    sweeper_running = false;
+  }
+  if (record_statistics) {
+    statistics_record_blocks(buffer_start, buffer.top);
+  }
   reset_free_lists();
-  free(memory_start);
-  memory_start = memory_end = NULL;
-  heap_start = bitmap_start = NULL;
+  munmap(memory_start, (size_t)((char*)memory_reserved_end - (char*)memory_start));
+  for (size_t i = 0; i < markers_count; i++) {
+    pthread_mutex_destroy(&markers[i].shared_lock);
+  }
+  free(markers);
+  markers = NULL;
+  free(compact_table);
+  compact_table = NULL;
+  compact_table_rows = 0;
+  free(large_objects);
+  large_objects = NULL;
+  large_count = large_capacity = large_allocated_words = large_live_words = 0;
+  large_start = large_end = NULL;
+  buffer.top = buffer.end = buffer_start = NULL;
+  memory_start = memory_end = heap_limit = memory_reserved_end = NULL;
+  heap_start = bitmap_start = mark_bitmap_start = sweep_free_start = NULL;
+  bitmap_rows = sweep_row = 0;
+  record_statistics = false;
+  sweep_nanoseconds = 0;
 }
 
 void* memory_get_start() {
@@ -361,7 +1372,9 @@ void* memory_get_start() {
 }
 
 void* memory_get_end() {
-  return memory_end;
+  // The code and the frames are followed by the heap, which can grow up
+  // to the end of the reserved memory
+  return memory_reserved_end;
 }
 
 void bitmap_allocation(const size_t heap_size) {
@@ -369,55 +1382,171 @@ void bitmap_allocation(const size_t heap_size) {
   bitmap_size += heap_size % VALUE_BITS == 0 ? 0 : 1;
 
   bitmap_start = heap_start;
-  heap_start = heap_start + bitmap_size;
-  memset(bitmap_start, 0, bitmap_size);
+  mark_bitmap_start = bitmap_start + bitmap_size;
+  heap_start = mark_bitmap_start + bitmap_size;
 }
 
 void free_lists_allocation() {
   reset_free_lists();
-  free_lists[NB_FREE_LISTS-1].first = heap_start;
-  free_lists[NB_FREE_LISTS-1].last = heap_start;
-  uvalue_t* ptr = free_lists[NB_FREE_LISTS-1].first;
-  *ptr = header_pack(tag_None, (uvalue_t)(memory_end-heap_start-HEADER_SIZE));
-  assert(ptr != NULL);
+  add_range_to_free_lists(heap_start, memory_end);
 }
 
 void memory_set_heap_start(void* heap_start_ptr) {
   assert(heap_start == NULL);
   heap_start = heap_start_ptr;
 
-  size_t heap_size = memory_end - heap_start;
-
-  assert(heap_size > 2);
-  bitmap_allocation(heap_size);
+  // The initial heap takes the rest of the memory, minus its bitmaps
+  size_t available = heap_start < memory_end ? (size_t)(memory_end - heap_start) : 0;
+  size_t bitmaps_size = 2 * (available / VALUE_BITS + 1);
+  if (available < bitmaps_size + 2 * (HEADER_SIZE + 1))
+    fail("not enough memory for the heap");
+  size_t heap_size = available - bitmaps_size;
+
+  heap_min_size = heap_min_size != 0 ? heap_min_size / sizeof(uvalue_t) : heap_size;
+  heap_size = MAX(heap_size, heap_min_size);
+  heap_max_size = MAX(heap_max_size / sizeof(uvalue_t), heap_size);
+
+  // The bitmaps are big enough for the biggest heap, but their pages
+  // are only used once touched
+  bitmap_allocation(heap_max_size);
+  heap_set_size(heap_size);
   free_lists_allocation();
+  sweep_row = bitmap_rows;
+
+  // With several threads, the heap is also swept in the background
+  if (markers_count > 1) {
+    sweeper_running = true;
+    sweeper_stopping = false;
+    if (pthread_create(&sweeper, NULL, sweeper_thread, NULL) != 0)
+      fail("cannot create sweeper thread");
+  }
 }
 
-uvalue_t* memory_allocate(tag_t tag, uvalue_t size) {
+/* Allocate a block of the given size from the free lists, or from the
+   allocation buffer if it was filled by a compaction, collecting the
+   heap if needed. The header of the block is not set. */
+static uvalue_t* allocate_block(const uvalue_t size) {
   assert(heap_start != NULL);
 
   const uvalue_t block_size = size != 0 ? size : 1;
 
-  uvalue_t* freeBlock = find_free_block(block_size);
+  // Sweep the heap lazily, until a free block is found
+  uvalue_t* freeBlock = buffer_allocate(block_size);
+  if (freeBlock == NULL) {
+    freeBlock = find_free_block_or_sweep(block_size);
+  }
   if (freeBlock == NULL) {
     gc_collect();
-    freeBlock = find_free_block(block_size);
+    freeBlock = buffer_allocate(block_size);
+    if (freeBlock == NULL) {
+      freeBlock = find_free_block_or_sweep(block_size);
+    }
+    // The free memory may be too fragmented for the block
+    if (freeBlock == NULL
+        && (size_t)(memory_end - heap_start) - sweep_live_words > block_size + HEADER_SIZE) {
+      compact();
+      freeBlock = buffer_allocate(block_size);
+    }
+    while (freeBlock == NULL && heap_grow(block_size)) {
+      freeBlock = find_free_block_or_sweep(block_size);
+    }
     if (freeBlock == NULL) {
       fail("Unable to allocate block of size %u\n", size);
     }
   }
+  return freeBlock;
+}
+
+/* Record the allocation of the given block, unless it was allocated in
+   the allocation buffer, whose blocks are recorded when it is retired */
+static void record_block_statistics(const uvalue_t* block) {
+  if (record_statistics && (block < buffer_start || block >= buffer.top)) {
+    statistics_record_block(header_unpack_tag(*block), *block >> 8);
+  }
+}
 
+/* Allocate a block of the given size in the large-object space,
+   collecting the heap first if the large blocks allocated since the last
+   collection take more memory than the heap, or if there is no room for
+   it. Return NULL if there is still no room. */
+static uvalue_t* allocate_large_block(const uvalue_t size) {
+  uvalue_t* block = NULL;
+  if (large_allocated_words <= (size_t)(memory_end - heap_start)) {
+    block = large_allocate(size);
+  }
+  if (block == NULL) {
+    sweep_complete();
+    gc_collect();
+    block = large_allocate(size);
+  }
+  return block;
+}
+
+uvalue_t* memory_allocate(tag_t tag, uvalue_t size) {
+  const uvalue_t block_size = size != 0 ? size : 1;
+  if (block_size + HEADER_SIZE <= ALLOCATION_BUFFER_SIZE) {
+    return memory_buffer_allocate(&buffer, tag, size);
+  }
+
+  uvalue_t* freeBlock = NULL;
+  if (block_size >= LARGE_BLOCK_SIZE) {
+    freeBlock = allocate_large_block(block_size);
+  }
+  if (freeBlock == NULL) {
+    freeBlock = allocate_block(size);
+  }
   *freeBlock = header_pack(tag, size);
-  set_block_bitmap(freeBlock);
   uvalue_t* res = freeBlock + HEADER_SIZE;
+  record_block_statistics(freeBlock);
 
   return res;
 }
 
+memory_buffer_t* memory_get_buffer() {
+  return &buffer;
+}
+
+uvalue_t* memory_buffer_refill(tag_t tag, uvalue_t size) {
+  assert(heap_start != NULL);
+
+  // Blocks which do not fit in a buffer are allocated on their own, and
+  // so are all blocks once no free block is big enough for a buffer
+  const uvalue_t block_size = size != 0 ? size : 1;
+  if (block_size + HEADER_SIZE > ALLOCATION_BUFFER_SIZE) {
+    return memory_allocate(tag, size);
+  }
+  const bool locked = sweep_lock_if_sweeping();
+  buffer_retire();
+  uvalue_t buffer_size = 0;
+  uvalue_t* free_block =
+    find_buffer_block_sweeping(MAX(block_size + HEADER_SIZE,
+                                   ALLOCATION_BUFFER_MIN_SIZE),
+                               &buffer_size);
+  if (free_block != NULL) {
+    buffer_fill(free_block, free_block + buffer_size);
+  }
+  if (locked) {
+    pthread_mutex_unlock(&sweep_lock);
+  }
+
+  if (free_block == NULL) {
+    free_block = allocate_block(size);
+  } else {
+    buffer.top += block_size + HEADER_SIZE;
+  }
+  *free_block = header_pack(tag, size);
+  record_block_statistics(free_block);
+  return free_block + HEADER_SIZE;
+}
+
 uvalue_t memory_get_block_size(uvalue_t* block) {
-  return header_unpack_size(block[-1]);
+  return block[-1] >> 8; // The actual size, even for blocks of size 0
 }
 
 tag_t memory_get_block_tag(uvalue_t* block) {
   return header_unpack_tag(block[-1]);
 }
+
+uint8_t* memory_get_card_table() {
+  return NULL;
+}
@@ -1,22 +1,24 @@
+#define _DEFAULT_SOURCE /* for mmap and madvise */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #include "memory.h"
 #include "fail.h"
+#include "statistics.h"
 
 static uvalue_t* memory_start = NULL;
 static uvalue_t* memory_end = NULL;
-static uvalue_t* free_boundary = NULL;
+static bool huge_pages = false;
 
-#define HEADER_SIZE 1
+/* The free memory is the allocation buffer, which is never refilled */
+static memory_buffer_t buffer = { NULL, NULL };
+static uvalue_t* heap_start = NULL;
 
 // Header management
-static uvalue_t header_pack(tag_t tag, uvalue_t size) {
-  return (size << 8) | (uvalue_t)tag;
-}
-
 static tag_t header_unpack_tag(uvalue_t header) {
   return (tag_t)(header & 0xFF);
 }
@@ -30,16 +32,48 @@ char* memory_get_identity() {
 }
 
 void memory_setup(size_t total_byte_size) {
-  memory_start = calloc(total_byte_size, 1);
-  if (memory_start == NULL)
+  // The memory is zero-filled and only backed once touched
+  void* memory = mmap(NULL, total_byte_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED)
     fail("cannot allocate %zd bytes of memory", total_byte_size);
+#ifdef MADV_HUGEPAGE
+  if (huge_pages)
+    madvise(memory, total_byte_size, MADV_HUGEPAGE);
+#endif
+  memory_start = memory;
   memory_end = memory_start + (total_byte_size / sizeof(value_t));
 }
 
+void memory_set_heap_limits(size_t min_size,
+                            size_t max_size,
+                            unsigned int target) {
+  if (min_size != 0 || max_size != 0 || target != 0)
+    fail("the heap size cannot be adapted by this memory system");
+}
+
+void memory_set_compact_always(bool always) {
+  if (always)
+    fail("the heap cannot be compacted by this memory system");
+}
+
+void memory_set_gc_threads(unsigned int count) {
+  if (count != 1)
+    fail("this memory system cannot use several threads");
+}
+
+void memory_set_huge_pages(bool huge) {
+  assert(memory_start == NULL);
+  huge_pages = huge;
+}
+
 void memory_cleanup() {
   assert(memory_start != NULL);
-  free(memory_start);
-  memory_start = memory_end = free_boundary = NULL;
+  // All the blocks ever allocated are between the heap start and the top
+  if (statistics_are_enabled())
+    statistics_record_blocks(heap_start, buffer.top);
+  munmap(memory_start, (size_t)((char*)memory_end - (char*)memory_start));
+  memory_start = memory_end = buffer.top = buffer.end = heap_start = NULL;
 }
 
 void* memory_get_start() {
@@ -50,23 +84,24 @@ void* memory_get_end() {
   return memory_end;
 }
 
-void memory_set_heap_start(void* heap_start) {
-  assert(free_boundary == NULL);
-  free_boundary = heap_start;
+void memory_set_heap_start(void* heap_start_ptr) {
+  assert(buffer.top == NULL);
+  buffer.top = heap_start = heap_start_ptr;
+  buffer.end = memory_end;
 }
 
 uvalue_t* memory_allocate(tag_t tag, uvalue_t size) {
-  assert(free_boundary != NULL);
-
-  const uvalue_t total_size = size + HEADER_SIZE;
-  if (free_boundary + total_size > memory_end)
-    fail("no memory left (block of size %u requested)", size);
+  assert(buffer.top != NULL);
+  return memory_buffer_allocate(&buffer, tag, size);
+}
 
-  *free_boundary = header_pack(tag, size);
-  uvalue_t* res = free_boundary + HEADER_SIZE;
-  free_boundary += total_size;
+memory_buffer_t* memory_get_buffer() {
+  return &buffer;
+}
 
-  return res;
+uvalue_t* memory_buffer_refill(tag_t tag, uvalue_t size) {
+  (void)tag;
+  fail("no memory left (block of size %u requested)", size);
 }
 
 uvalue_t memory_get_block_size(uvalue_t* block) {
@@ -76,3 +111,7 @@ uvalue_t memory_get_block_size(uvalue_t* block) {
 tag_t memory_get_block_tag(uvalue_t* block) {
   return header_unpack_tag(block[-1]);
 }
+
+uint8_t* memory_get_card_table() {
+  return NULL;
+}
@@ -8,9 +8,11 @@ typedef enum {
   opcode_TCAL, opcode_CALL, opcode_RET, opcode_HALT,
   opcode_LDLO, opcode_LDHI, opcode_MOVE,
   opcode_RALO, opcode_BALO, opcode_BSIZ, opcode_BTAG, opcode_BGET, opcode_BSET,
-  opcode_BREA, opcode_BWRI,
+  opcode_BREA, opcode_BWRI, opcode_BLKR, opcode_BLKW,
+  opcode_ADDI, opcode_SUBI, opcode_LSLI, opcode_LSRI, opcode_ANDI, opcode_ORI,
+  opcode_JLTI, opcode_JLEI, opcode_JGTI, opcode_JGEI, opcode_JEQI, opcode_JNEI,
 } opcode_t;
 
-#define OPCODE_COUNT (opcode_BWRI+1)
+#define OPCODE_COUNT (opcode_JNEI+1)
 
 #endif // OPCODE_H
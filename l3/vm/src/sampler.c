@@ -0,0 +1,206 @@
+#define _DEFAULT_SOURCE /* for sigaction and setitimer */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "sampler.h"
+#include "symbols.h"
+#include "fail.h"
+
+/* Interval between two samples, in microseconds of CPU time */
+#define SAMPLER_INTERVAL_USEC 1000
+
+/* Initial number of entries of the stack table (a power of 2) */
+#define SAMPLER_INITIAL_CAPACITY 1024
+
+/* Frame key standing for the missing frames of truncated samples */
+#define TRUNCATED_FRAME UINT32_MAX
+
+static void write_frame(FILE* file, uvalue_t frame) {
+  if (frame == TRUNCATED_FRAME)
+    fputs("[truncated]", file);
+  else
+    symbols_write_name(file, frame);
+}
+
+// Stack table
+
+/* Distinct call stack. Its frames, stored from the innermost to the
+   outermost in the frames array, are the addresses of the functions
+   containing the recorded code addresses. */
+typedef struct {
+  size_t frames_index;
+  size_t length;
+  uint64_t count;               /* 0 for free entries */
+  uint32_t hash;
+} sampled_stack_t;
+
+static sampled_stack_t* stacks; /* open-addressing hash table */
+static size_t stacks_capacity;
+static size_t stacks_count;
+
+static uvalue_t* frames;
+static size_t frames_size;
+static size_t frames_capacity;
+
+static uint32_t stack_hash(const uvalue_t* stack_frames, size_t length) {
+  uint32_t hash = 2166136261u;  /* FNV-1a */
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= stack_frames[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static sampled_stack_t* stacks_find(uint32_t hash,
+                                    const uvalue_t* stack_frames,
+                                    size_t length) {
+  size_t mask = stacks_capacity - 1;
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    sampled_stack_t* stack = &stacks[i];
+    if (stack->count == 0
+        || (stack->hash == hash
+            && stack->length == length
+            && memcmp(&frames[stack->frames_index],
+                      stack_frames,
+                      length * sizeof(uvalue_t)) == 0))
+      return stack;
+  }
+}
+
+static void stacks_grow(void) {
+  sampled_stack_t* old_stacks = stacks;
+  size_t old_capacity = stacks_capacity;
+
+  stacks_capacity = old_capacity == 0
+    ? SAMPLER_INITIAL_CAPACITY
+    : 2 * old_capacity;
+  stacks = calloc(stacks_capacity, sizeof(sampled_stack_t));
+  if (stacks == NULL)
+    fail("cannot allocate memory for samples");
+
+  for (size_t i = 0; i < old_capacity; ++i) {
+    sampled_stack_t* old_stack = &old_stacks[i];
+    if (old_stack->count > 0)
+      *stacks_find(old_stack->hash,
+                   &frames[old_stack->frames_index],
+                   old_stack->length) = *old_stack;
+  }
+  free(old_stacks);
+}
+
+void sampler_record(const uvalue_t addresses[],
+                    size_t count,
+                    bool truncated) {
+  if (2 * (stacks_count + 1) > stacks_capacity)
+    stacks_grow();
+
+  /* The frames are built at the end of the frames array, which is
+     only extended if the stack was not seen before. */
+  size_t length = count + (truncated ? 1 : 0);
+  if (frames_size + length > frames_capacity) {
+    while (frames_size + length > frames_capacity)
+      frames_capacity = frames_capacity == 0 ? 4096 : 2 * frames_capacity;
+    frames = realloc(frames, frames_capacity * sizeof(uvalue_t));
+    if (frames == NULL)
+      fail("cannot allocate memory for samples");
+  }
+  uvalue_t* stack_frames = &frames[frames_size];
+  for (size_t i = 0; i < count; ++i)
+    stack_frames[i] = symbols_function(addresses[i]);
+  if (truncated)
+    stack_frames[count] = TRUNCATED_FRAME;
+
+  uint32_t hash = stack_hash(stack_frames, length);
+  sampled_stack_t* stack = stacks_find(hash, stack_frames, length);
+  if (stack->count == 0) {
+    stack->frames_index = frames_size;
+    stack->length = length;
+    stack->hash = hash;
+    frames_size += length;
+    stacks_count += 1;
+  }
+  stack->count += 1;
+}
+
+static int stack_compare_count(const void* v1, const void* v2) {
+  const sampled_stack_t* s1 = v1;
+  const sampled_stack_t* s2 = v2;
+  return (s1->count < s2->count) - (s1->count > s2->count);
+}
+
+void sampler_write(char* file_name) {
+  FILE* file = fopen(file_name, "w");
+  if (file == NULL)
+    fail("cannot open file %s", file_name);
+
+  /* The stacks are moved to the start of the table, which is not
+     searched anymore, and sorted, most frequent first */
+  size_t live_count = 0;
+  for (size_t i = 0; i < stacks_capacity; ++i) {
+    if (stacks[i].count != 0)
+      stacks[live_count++] = stacks[i];
+  }
+  if (live_count > 0)
+    qsort(stacks, live_count, sizeof(sampled_stack_t),
+          stack_compare_count);
+  for (size_t i = 0; i < live_count; ++i) {
+    sampled_stack_t* stack = &stacks[i];
+    for (size_t j = stack->length; j > 0; --j) {
+      write_frame(file, frames[stack->frames_index + j - 1]);
+      fputc(j > 1 ? ';' : ' ', file);
+    }
+    fprintf(file, "%llu\n", (unsigned long long)stack->count);
+  }
+  fclose(file);
+
+  free(stacks);
+  free(frames);
+  stacks = NULL;
+  stacks_capacity = stacks_count = 0;
+  frames = NULL;
+  frames_size = frames_capacity = 0;
+}
+
+// Timer
+
+static void (*volatile sample_requester)(void);
+
+static void handle_sigprof(int signal_number) {
+  (void)signal_number;
+  void (*request_sample)(void) = sample_requester;
+  if (request_sample != NULL)
+    request_sample();
+}
+
+void sampler_start(void (*request_sample)(void)) {
+  sample_requester = request_sample;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_sigprof;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, NULL) != 0)
+    fail("cannot install the sampling signal handler");
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = SAMPLER_INTERVAL_USEC;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0)
+    fail("cannot start the sampling timer");
+}
+
+void sampler_stop(void) {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  /* A signal may still be pending */
+  sample_requester = NULL;
+  signal(SIGPROF, SIG_IGN);
+}
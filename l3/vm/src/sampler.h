@@ -0,0 +1,32 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "vmtypes.h"
+
+/* Statistical profiler. A CPU-time timer periodically asks the engine
+   to take a sample, i.e. to record the current code address and the
+   return addresses of all active frames. Samples are aggregated by
+   call stack, and written as folded stacks (one line per stack, from
+   the outermost function to the innermost one, followed by its sample
+   count), as expected by flame graph tools. Code addresses are mapped
+   to function names using the symbol table (see symbols.h). */
+
+/* Start the timer, which calls request_sample from a signal handler */
+void sampler_start(void (*request_sample)(void));
+
+/* Stop the timer. request_sample is not called anymore afterwards. */
+void sampler_stop(void);
+
+/* Record a sample, given as code addresses from the innermost (the
+   current one) to the outermost. A truncated sample misses its
+   outermost frames. */
+void sampler_record(const uvalue_t addresses[],
+                    size_t count,
+                    bool truncated);
+
+/* Write the folded stacks to the given file, and free all samples */
+void sampler_write(char* file_name);
+
+#endif // SAMPLER_H
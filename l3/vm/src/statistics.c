@@ -0,0 +1,262 @@
+#define _DEFAULT_SOURCE /* for clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "statistics.h"
+#include "fail.h"
+
+/* Buckets of the duration histograms. Bucket i counts the durations of
+   at least 2^i nanoseconds and less than 2^(i+1), the first one also
+   the shorter ones, and the last one also the longer ones. */
+#define HISTOGRAM_BUCKETS 40
+
+static bool enabled = false;
+
+void statistics_enable(void) {
+  enabled = true;
+}
+
+bool statistics_are_enabled(void) {
+  return enabled;
+}
+
+uint64_t statistics_clock(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Phases
+
+typedef struct {
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} phase_statistics_t;
+
+static const char* const phase_names[statistics_phases_count] = {
+  "mark", "sweep", "compact", "minor"
+};
+
+static phase_statistics_t phases[statistics_phases_count];
+
+void statistics_record_phase(statistics_phase_t phase, uint64_t nanoseconds) {
+  phase_statistics_t* statistics = &phases[phase];
+  unsigned int bucket = nanoseconds == 0
+    ? 0
+    : 63u - (unsigned int)__builtin_clzll(nanoseconds);
+  statistics->count += 1;
+  statistics->total += nanoseconds;
+  if (nanoseconds > statistics->max)
+    statistics->max = nanoseconds;
+  statistics->buckets[bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1] += 1;
+}
+
+// Allocations
+
+typedef struct {
+  uint64_t blocks;
+  uint64_t words;               /* headers included */
+} allocation_statistics_t;
+
+static allocation_statistics_t allocations[256]; /* by tag */
+
+/* Number of words occupied by a block of the given size, which has at
+   least one word of body (see memory_buffer_allocate) */
+static size_t block_words(uvalue_t size) {
+  return 1 + (size != 0 ? (size_t)size : 1);
+}
+
+void statistics_record_block(tag_t tag, uvalue_t size) {
+  allocations[tag & 0xFF].blocks += 1;
+  allocations[tag & 0xFF].words += block_words(size);
+}
+
+void statistics_record_blocks(const uvalue_t* start, const uvalue_t* end) {
+  for (const uvalue_t* block = start; block < end; block += block_words(*block >> 8))
+    statistics_record_block((tag_t)(*block & 0xFF), *block >> 8);
+}
+
+// Heap
+
+typedef struct {
+  size_t live_words;
+  size_t heap_words;
+  size_t free_words;
+  size_t largest_free_words;
+} heap_statistics_t;
+
+typedef struct {
+  size_t min_size;
+  uint64_t total_length;        /* over all collections */
+  size_t max_length;
+} free_list_statistics_t;
+
+static heap_statistics_t* heaps;
+static size_t heaps_count;
+static size_t heaps_capacity;
+
+static free_list_statistics_t* free_lists;
+static size_t free_lists_count;
+
+void statistics_record_heap(size_t live_words,
+                            size_t heap_words,
+                            size_t free_words,
+                            size_t largest_free_words) {
+  if (heaps_count == heaps_capacity) {
+    heaps_capacity = heaps_capacity == 0 ? 64 : 2 * heaps_capacity;
+    heaps = realloc(heaps, heaps_capacity * sizeof(heap_statistics_t));
+    if (heaps == NULL)
+      fail("cannot allocate memory for statistics");
+  }
+  heaps[heaps_count++] =
+    (heap_statistics_t){ live_words, heap_words, free_words, largest_free_words };
+}
+
+void statistics_record_free_list(size_t index,
+                                 size_t min_size,
+                                 size_t length) {
+  if (index >= free_lists_count) {
+    free_lists = realloc(free_lists, (index + 1) * sizeof(free_list_statistics_t));
+    if (free_lists == NULL)
+      fail("cannot allocate memory for statistics");
+    memset(&free_lists[free_lists_count], 0,
+           (index + 1 - free_lists_count) * sizeof(free_list_statistics_t));
+    free_lists_count = index + 1;
+  }
+  free_list_statistics_t* statistics = &free_lists[index];
+  statistics->min_size = min_size;
+  statistics->total_length += length;
+  if (length > statistics->max_length)
+    statistics->max_length = length;
+}
+
+// Output
+
+static unsigned long long bytes(uint64_t words) {
+  return (unsigned long long)(words * sizeof(uvalue_t));
+}
+
+static void write_tag(FILE* file, unsigned int tag) {
+  switch (tag) {
+  case tag_String: fputs("\"String\"", file); break;
+  case tag_RegisterFrame: fputs("\"RegisterFrame\"", file); break;
+  case tag_Function: fputs("\"Function\"", file); break;
+  default: fprintf(file, "\"%u\"", tag); break;
+  }
+}
+
+static void write_phases(FILE* file) {
+  fputs("  \"phases\": {", file);
+  for (size_t p = 0; p < statistics_phases_count; ++p) {
+    phase_statistics_t* statistics = &phases[p];
+    fprintf(file, "%s\n    \"%s\": { \"count\": %llu, \"total_ns\": %llu,"
+            " \"max_ns\": %llu, \"histogram\": [",
+            p > 0 ? "," : "", phase_names[p],
+            (unsigned long long)statistics->count,
+            (unsigned long long)statistics->total,
+            (unsigned long long)statistics->max);
+    const char* separator = "";
+    for (unsigned int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+      if (statistics->buckets[b] == 0)
+        continue;
+      fprintf(file, "%s{ \"min_ns\": %llu, \"count\": %llu }",
+              separator, b == 0 ? 0ull : 1ull << b,
+              (unsigned long long)statistics->buckets[b]);
+      separator = ", ";
+    }
+    fputs("] }", file);
+  }
+  fputs("\n  },\n", file);
+}
+
+static void write_allocations(FILE* file) {
+  uint64_t total_blocks = 0, total_words = 0;
+  for (unsigned int tag = 0; tag < 256; ++tag) {
+    total_blocks += allocations[tag].blocks;
+    total_words += allocations[tag].words;
+  }
+  fprintf(file, "  \"allocations\": { \"blocks\": %llu, \"bytes\": %llu,"
+          " \"tags\": [",
+          (unsigned long long)total_blocks, bytes(total_words));
+  const char* separator = "";
+  for (unsigned int tag = 0; tag < 256; ++tag) {
+    if (allocations[tag].blocks == 0)
+      continue;
+    fprintf(file, "%s\n    { \"tag\": ", separator);
+    write_tag(file, tag);
+    fprintf(file, ", \"blocks\": %llu, \"bytes\": %llu }",
+            (unsigned long long)allocations[tag].blocks,
+            bytes(allocations[tag].words));
+    separator = ",";
+  }
+  fputs("\n  ] },\n", file);
+}
+
+/* The fragmentation of the free memory is the part of it which is not
+   in its biggest block: 0 when it is all in one block, and close to 1
+   when it is scattered in many small ones. */
+static void write_heaps(FILE* file) {
+  fputs("  \"heap\": [", file);
+  for (size_t i = 0; i < heaps_count; ++i) {
+    heap_statistics_t* heap = &heaps[i];
+    double fragmentation = heap->free_words == 0
+      ? 0.0
+      : 1.0 - (double)heap->largest_free_words / (double)heap->free_words;
+    fprintf(file, "%s\n    { \"live_bytes\": %llu, \"heap_bytes\": %llu,"
+            " \"free_bytes\": %llu, \"largest_free_bytes\": %llu,"
+            " \"fragmentation\": %.4f }",
+            i > 0 ? "," : "",
+            bytes(heap->live_words), bytes(heap->heap_words),
+            bytes(heap->free_words), bytes(heap->largest_free_words),
+            fragmentation);
+  }
+  fputs("\n  ],\n", file);
+}
+
+static void write_free_lists(FILE* file) {
+  fputs("  \"free_lists\": [", file);
+  const char* separator = "";
+  for (size_t i = 0; i < free_lists_count; ++i) {
+    free_list_statistics_t* statistics = &free_lists[i];
+    if (statistics->max_length == 0)
+      continue;
+    fprintf(file, "%s\n    { \"min_size\": %zu, \"mean_length\": %.2f,"
+            " \"max_length\": %zu }",
+            separator, statistics->min_size,
+            (double)statistics->total_length / (double)heaps_count,
+            statistics->max_length);
+    separator = ",";
+  }
+  fputs("\n  ]\n", file);
+}
+
+void statistics_write(char* file_name, const char* memory_identity) {
+  FILE* file = fopen(file_name, "w");
+  if (file == NULL)
+    fail("cannot open file %s", file_name);
+
+  fprintf(file, "{\n  \"memory\": \"%s\",\n", memory_identity);
+  fprintf(file, "  \"collections\": %llu,\n",
+          (unsigned long long)(phases[statistics_mark].count
+                               + phases[statistics_minor].count));
+  write_phases(file);
+  write_allocations(file);
+  write_heaps(file);
+  write_free_lists(file);
+  fputs("}\n", file);
+  fclose(file);
+
+  free(heaps);
+  free(free_lists);
+  heaps = NULL;
+  heaps_count = heaps_capacity = 0;
+  free_lists = NULL;
+  free_lists_count = 0;
+  memset(phases, 0, sizeof(phases));
+  memset(allocations, 0, sizeof(allocations));
+}
@@ -0,0 +1,61 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vmtypes.h"
+#include "memory.h"
+
+/* Statistics of the memory system. Once enabled, the memory modules
+   record the blocks allocated, the duration of the phases of their
+   collections, and the state of their heap after each collection. These
+   are written as JSON on exit. */
+
+typedef enum {
+  statistics_mark,              /* marking of a (major) collection */
+  statistics_sweep,             /* whole sweep, lazy or not */
+  statistics_compact,
+  statistics_minor,             /* minor collection */
+  statistics_phases_count
+} statistics_phase_t;
+
+/* Enable the statistics, before memory_setup */
+void statistics_enable(void);
+
+/* Return true if the statistics are enabled */
+bool statistics_are_enabled(void);
+
+/* Return the current time, in nanoseconds of a monotonic clock */
+uint64_t statistics_clock(void);
+
+/* Record a phase of a collection which took the given time */
+void statistics_record_phase(statistics_phase_t phase, uint64_t nanoseconds);
+
+/* Record the allocation of a block of the given tag and size */
+void statistics_record_block(tag_t tag, uvalue_t size);
+
+/* Record the allocation of all the blocks between start and end, which
+   follow each other as in an allocation buffer */
+void statistics_record_blocks(const uvalue_t* start, const uvalue_t* end);
+
+/* Record the state of the heap after a collection, in words: the live
+   data, the size of the heap, its free memory and its biggest free
+   block */
+void statistics_record_heap(size_t live_words,
+                            size_t heap_words,
+                            size_t free_words,
+                            size_t largest_free_words);
+
+/* Record the length of the free list of the given index after a
+   collection, whose blocks have a size of at least min_size, i.e. their
+   body has at least that many words. Empty free lists need not be
+   recorded. */
+void statistics_record_free_list(size_t index,
+                                 size_t min_size,
+                                 size_t length);
+
+/* Write the statistics to the given file, and free them */
+void statistics_write(char* file_name, const char* memory_identity);
+
+#endif // STATISTICS_H
@@ -0,0 +1,33 @@
+/* Superinstructions, generated by `make superinstructions`. */
+SUPERINSTRUCTION2(LDLO, MOVE)
+SUPERINSTRUCTION2(MOVE, MOVE)
+SUPERINSTRUCTION3(LDLO, MOVE, MOVE)
+SUPERINSTRUCTION3(LDLO, LSL, XOR)
+SUPERINSTRUCTION3(LSL, XOR, JNE)
+SUPERINSTRUCTION3(LDLO, BTAG, LDLO)
+SUPERINSTRUCTION3(BTAG, LDLO, LSL)
+SUPERINSTRUCTION3(RALO, RALO, LDLO)
+SUPERINSTRUCTION3(MOVE, MOVE, CALL)
+SUPERINSTRUCTION3(MOVE, MOVE, MOVE)
+SUPERINSTRUCTION3(RALO, LDLO, BTAG)
+SUPERINSTRUCTION3(BGET, LDLO, MOVE)
+SUPERINSTRUCTION2(LDLO, BGET)
+SUPERINSTRUCTION2(LSL, XOR)
+SUPERINSTRUCTION3(MOVE, LDLO, JEQ)
+SUPERINSTRUCTION2(LDLO, JEQ)
+SUPERINSTRUCTION3(LDLO, MOVE, JI)
+SUPERINSTRUCTION2(RALO, LDLO)
+SUPERINSTRUCTION2(MOVE, LDLO)
+SUPERINSTRUCTION2(MOVE, JI)
+SUPERINSTRUCTION2(LDLO, LSL)
+SUPERINSTRUCTION2(XOR, JNE)
+SUPERINSTRUCTION2(LDLO, BTAG)
+SUPERINSTRUCTION2(BTAG, LDLO)
+SUPERINSTRUCTION2(MOVE, CALL)
+SUPERINSTRUCTION2(RALO, RALO)
+SUPERINSTRUCTION2(MOVE, RET)
+SUPERINSTRUCTION2(BGET, LDLO)
+SUPERINSTRUCTION3(LDLO, BGET, BGET)
+SUPERINSTRUCTION3(RALO, LDLO, BGET)
+SUPERINSTRUCTION3(MOVE, MOVE, TCAL)
+SUPERINSTRUCTION3(LDLO, MOVE, RET)
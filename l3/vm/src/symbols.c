@@ -0,0 +1,96 @@
+#define _DEFAULT_SOURCE /* for strndup */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "symbols.h"
+#include "fail.h"
+
+typedef struct {
+  uvalue_t address;
+  char* name;
+} symbol_t;
+
+static symbol_t* symbols;       /* sorted by address once looked up */
+static size_t symbols_count;
+static size_t symbols_capacity;
+static bool symbols_sorted;
+
+static int symbol_compare(const void* v1, const void* v2) {
+  const symbol_t* s1 = v1;
+  const symbol_t* s2 = v2;
+  return (s1->address > s2->address) - (s1->address < s2->address);
+}
+
+void symbols_add(uvalue_t address, const char* name, size_t name_length) {
+  if (symbols_count == symbols_capacity) {
+    symbols_capacity = symbols_capacity == 0 ? 64 : 2 * symbols_capacity;
+    symbols = realloc(symbols, symbols_capacity * sizeof(symbol_t));
+    if (symbols == NULL)
+      fail("cannot allocate memory for symbols");
+  }
+  symbols[symbols_count].address = address;
+  symbols[symbols_count].name = strndup(name, name_length);
+  if (symbols[symbols_count].name == NULL)
+    fail("cannot allocate memory for symbols");
+  symbols_count += 1;
+  symbols_sorted = false;
+}
+
+bool symbols_load(char* file_name) {
+  FILE* file = fopen(file_name, "r");
+  if (file == NULL)
+    return false;
+
+  char line[1000];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    uvalue_t address;
+    char name[sizeof(line)];
+    if (sscanf(line, "%8x %999s", &address, name) != 2)
+      fail("error while reading file %s", file_name);
+    symbols_add(address, name, strlen(name));
+  }
+  fclose(file);
+  return true;
+}
+
+static void symbols_sort(void) {
+  if (!symbols_sorted && symbols_count > 0) {
+    qsort(symbols, symbols_count, sizeof(symbol_t), symbol_compare);
+    symbols_sorted = true;
+  }
+}
+
+uvalue_t symbols_function(uvalue_t address) {
+  symbols_sort();
+  size_t lo = 0, hi = symbols_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (symbols[mid].address <= address)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo > 0 ? symbols[lo - 1].address : address;
+}
+
+void symbols_write_name(FILE* file, uvalue_t address) {
+  symbols_sort();
+  symbol_t key = { address, NULL };
+  symbol_t* symbol = symbols_count == 0
+    ? NULL
+    : bsearch(&key, symbols, symbols_count, sizeof(symbol_t), symbol_compare);
+  if (symbol != NULL)
+    fputs(symbol->name, file);
+  else
+    fprintf(file, "0x%x", address);
+}
+
+void symbols_cleanup(void) {
+  for (size_t i = 0; i < symbols_count; ++i)
+    free(symbols[i].name);
+  free(symbols);
+  symbols = NULL;
+  symbols_count = symbols_capacity = 0;
+  symbols_sorted = false;
+}
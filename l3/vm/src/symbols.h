@@ -0,0 +1,33 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "vmtypes.h"
+
+/* Symbol table of the program, mapping the code addresses of its
+   functions to their names, used by the profilers */
+
+/* Add the symbol of the function starting at the given code address */
+void symbols_add(uvalue_t address, const char* name, size_t name_length);
+
+/* Add the symbols of the map written by the compiler next to the
+   assembly file. Each line contains the code address of a function,
+   in hexadecimal, followed by its name. Return false if the file
+   cannot be opened. */
+bool symbols_load(char* file_name);
+
+/* Return the address of the function containing the given code
+   address, i.e. of the closest symbol at or below it, or the address
+   itself if there is no such symbol */
+uvalue_t symbols_function(uvalue_t address);
+
+/* Write the name of the function starting at the given code address,
+   or the address itself if it has no symbol */
+void symbols_write_name(FILE* file, uvalue_t address);
+
+/* Free all symbols */
+void symbols_cleanup(void);
+
+#endif // SYMBOLS_H